@@ -0,0 +1,199 @@
+#include <array>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include "chunk_codec.h"
+
+namespace cscd {
+namespace file {
+
+void RawCodec::encode(const uint8_t* src, size_t size, std::vector<uint8_t>& dst) const {
+    dst.insert(dst.end(), src, src + size);
+}
+
+void RawCodec::decode(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) const {
+    if (src_size != dst_size) {
+        throw std::runtime_error("Raw chunk payload has the wrong size!");
+    }
+    std::memcpy(dst, src, dst_size);
+}
+
+void RleCodec::encode(const uint8_t* src, size_t size, std::vector<uint8_t>& dst) const {
+    size_t i = 0;
+    while (i < size) {
+        uint8_t value = src[i];
+        size_t run = 1;
+        while (i + run < size && src[i + run] == value) {
+            run++;
+        }
+
+        dst.push_back(value);
+        size_t remaining = run;
+        do {
+            uint8_t byte = remaining & 0x7F;
+            remaining >>= 7;
+            if (remaining != 0) {
+                byte |= 0x80;
+            }
+            dst.push_back(byte);
+        } while (remaining != 0);
+
+        i += run;
+    }
+}
+
+void RleCodec::decode(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) const {
+    size_t in = 0;
+    size_t out = 0;
+    while (in < src_size) {
+        uint8_t value = src[in++];
+
+        size_t run = 0;
+        int shift = 0;
+        uint8_t byte;
+        do {
+            if (in >= src_size || shift > 56) {
+                throw std::runtime_error("Truncated RLE run length!");
+            }
+            byte = src[in++];
+            run |= (size_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        if (run > dst_size - out) {
+            throw std::runtime_error("RLE chunk payload overflows its chunk!");
+        }
+        std::memset(dst + out, value, run);
+        out += run;
+    }
+
+    if (out != dst_size) {
+        throw std::runtime_error("RLE chunk payload is shorter than its chunk!");
+    }
+}
+
+void UniformCodec::encode(const uint8_t* src, size_t size, std::vector<uint8_t>& dst) const {
+    if (size == 0 || !isUniform(src, size)) {
+        throw std::runtime_error("Uniform codec given a chunk with more than one value!");
+    }
+    dst.push_back(src[0]);
+}
+
+void UniformCodec::decode(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) const {
+    if (src_size != 1) {
+        throw std::runtime_error("Uniform chunk payload has the wrong size!");
+    }
+    std::memset(dst, src[0], dst_size);
+}
+
+static std::array<std::unique_ptr<ChunkCodec>, CHUNK_CODEC_SLOTS>& codecSlots() {
+    static std::array<std::unique_ptr<ChunkCodec>, CHUNK_CODEC_SLOTS> slots = [] {
+        std::array<std::unique_ptr<ChunkCodec>, CHUNK_CODEC_SLOTS> defaults{};
+        defaults[(size_t)ChunkCodecType::RAW] = std::make_unique<RawCodec>();
+        defaults[(size_t)ChunkCodecType::RLE] = std::make_unique<RleCodec>();
+        defaults[(size_t)ChunkCodecType::UNIFORM] = std::make_unique<UniformCodec>();
+        return defaults;
+    }();
+    return slots;
+}
+
+const ChunkCodec& getChunkCodec(ChunkCodecType type) {
+    size_t slot = (size_t)type;
+    if (slot >= CHUNK_CODEC_SLOTS || !codecSlots()[slot]) {
+        throw std::runtime_error("Unknown chunk codec " + std::to_string(slot) + "!");
+    }
+    return *codecSlots()[slot];
+}
+
+void registerChunkCodec(std::unique_ptr<ChunkCodec> codec) {
+    size_t slot = (size_t)codec->type();
+    if (slot >= CHUNK_CODEC_SLOTS) {
+        throw std::runtime_error("Chunk codec id out of range!");
+    }
+    codecSlots()[slot] = std::move(codec);
+}
+
+// FNV-1a, 32 bit
+static uint32_t fnv1a(const uint8_t* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#define XXH_PRIME32_1 0x9E3779B1u
+#define XXH_PRIME32_2 0x85EBCA77u
+#define XXH_PRIME32_3 0xC2B2AE3Du
+#define XXH_PRIME32_4 0x27D4EB2Fu
+#define XXH_PRIME32_5 0x165667B1u
+
+static uint32_t rotl32(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static uint32_t read32(const uint8_t* data) {
+    uint32_t value;
+    std::memcpy(&value, data, 4);
+    return value;
+}
+
+static uint32_t xxh32Round(uint32_t acc, uint32_t lane) {
+    return rotl32(acc + lane * XXH_PRIME32_2, 13) * XXH_PRIME32_1;
+}
+
+static uint32_t xxh32(const uint8_t* data, size_t size, uint32_t seed) {
+    const uint8_t* end = data + size;
+    uint32_t hash;
+
+    if (size >= 16) {
+        uint32_t v1 = seed + XXH_PRIME32_1 + XXH_PRIME32_2;
+        uint32_t v2 = seed + XXH_PRIME32_2;
+        uint32_t v3 = seed;
+        uint32_t v4 = seed - XXH_PRIME32_1;
+        const uint8_t* limit = end - 16;
+        do {
+            v1 = xxh32Round(v1, read32(data));
+            v2 = xxh32Round(v2, read32(data + 4));
+            v3 = xxh32Round(v3, read32(data + 8));
+            v4 = xxh32Round(v4, read32(data + 12));
+            data += 16;
+        } while (data <= limit);
+        hash = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+    } else {
+        hash = seed + XXH_PRIME32_5;
+    }
+
+    hash += (uint32_t)size;
+    for (; data + 4 <= end; data += 4) {
+        hash = rotl32(hash + read32(data) * XXH_PRIME32_3, 17) * XXH_PRIME32_4;
+    }
+    for (; data < end; data++) {
+        hash = rotl32(hash + *data * XXH_PRIME32_5, 11) * XXH_PRIME32_1;
+    }
+
+    hash ^= hash >> 15;
+    hash *= XXH_PRIME32_2;
+    hash ^= hash >> 13;
+    hash *= XXH_PRIME32_3;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+uint32_t chunkChecksum(const uint8_t* data, size_t size, ChunkChecksumType type) {
+    switch (type) {
+        case ChunkChecksumType::FNV1A:
+            return fnv1a(data, size);
+        case ChunkChecksumType::XXH32:
+            return xxh32(data, size, 0);
+    }
+    throw std::runtime_error("Unknown chunk checksum " + std::to_string((int)type) + "!");
+}
+
+uint64_t chunkContentHash(const uint8_t* data, size_t size) {
+    return (uint64_t)xxh32(data, size, 0) | (uint64_t)xxh32(data, size, XXH_PRIME32_1) << 32;
+}
+
+}
+}
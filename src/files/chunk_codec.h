@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace cscd {
+namespace file {
+
+// Identifies the codec a chunk payload was encoded with. Stored per chunk in
+// the CCST v2 chunk directory, so new codecs can be slotted in without
+// touching the container format.
+enum class ChunkCodecType : uint8_t {
+    RAW     = 0,
+    RLE     = 1,
+    UNIFORM = 2
+};
+
+#define CHUNK_CODEC_SLOTS 16
+
+// Checksum stored with each chunk payload. FNV-1a works a byte at a time, so
+// new files use XXH32, which takes 16 bytes per step.
+enum class ChunkChecksumType : uint8_t {
+    FNV1A   = 0,
+    XXH32   = 1
+};
+
+class ChunkCodec {
+public:
+    virtual ~ChunkCodec() = default;
+
+    virtual ChunkCodecType type() const = 0;
+
+    // Appends the encoded form of src to dst.
+    virtual void encode(const uint8_t* src, size_t size, std::vector<uint8_t>& dst) const = 0;
+    // Decodes exactly dst_size bytes into dst, throws if the payload is malformed.
+    virtual void decode(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) const = 0;
+};
+
+class RawCodec : public ChunkCodec {
+public:
+    ChunkCodecType type() const override { return ChunkCodecType::RAW; }
+    void encode(const uint8_t* src, size_t size, std::vector<uint8_t>& dst) const override;
+    void decode(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) const override;
+};
+
+// Runs are stored as (value, LEB128 run length) pairs.
+class RleCodec : public ChunkCodec {
+public:
+    ChunkCodecType type() const override { return ChunkCodecType::RLE; }
+    void encode(const uint8_t* src, size_t size, std::vector<uint8_t>& dst) const override;
+    void decode(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) const override;
+};
+
+// A chunk holding one value throughout, stored as that single byte. Decodes to
+// any size, so edge chunks can share a payload with full ones.
+class UniformCodec : public ChunkCodec {
+public:
+    ChunkCodecType type() const override { return ChunkCodecType::UNIFORM; }
+    void encode(const uint8_t* src, size_t size, std::vector<uint8_t>& dst) const override;
+    void decode(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size) const override;
+};
+
+inline bool isUniform(const uint8_t* data, size_t size) {
+    return size == 0 || std::memcmp(data, data + 1, size - 1) == 0;
+}
+
+const ChunkCodec& getChunkCodec(ChunkCodecType type);
+void registerChunkCodec(std::unique_ptr<ChunkCodec> codec);
+
+uint32_t chunkChecksum(const uint8_t* data, size_t size, ChunkChecksumType type = ChunkChecksumType::FNV1A);
+// 64 bit hash used to find identical payloads, two XXH32 passes with different seeds
+uint64_t chunkContentHash(const uint8_t* data, size_t size);
+
+}
+}
@@ -0,0 +1,649 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "chunked_state.h"
+
+namespace cscd {
+namespace file {
+
+ChunkGrid::ChunkGrid(glm::uvec3 dimensions_, uint32_t chunk_size_) :
+    dimensions{dimensions_},
+    chunk_size{chunk_size_}
+{
+    if (chunk_size == 0) {
+        throw std::runtime_error("Chunk size must be non-zero!");
+    }
+    counts = (dimensions + glm::uvec3(chunk_size - 1)) / chunk_size;
+}
+
+glm::uvec3 ChunkGrid::chunkCoords(uint32_t index) const {
+    return glm::uvec3{
+        index % counts.x,
+        (index / counts.x) % counts.y,
+        index / (counts.x * counts.y)
+    };
+}
+
+glm::uvec3 ChunkGrid::chunkExtent(uint32_t index) const {
+    glm::uvec3 origin = chunkOrigin(index);
+    return glm::min(glm::uvec3(chunk_size), dimensions - origin);
+}
+
+size_t ChunkGrid::chunkVolume(uint32_t index) const {
+    glm::uvec3 extent = chunkExtent(index);
+    return (size_t)extent.x * extent.y * extent.z;
+}
+
+void ChunkGrid::gather(const uint8_t* grid, uint32_t index, uint8_t* chunk) const {
+    glm::uvec3 origin = chunkOrigin(index);
+    glm::uvec3 extent = chunkExtent(index);
+    for (uint32_t z = 0; z < extent.z; z++) {
+        for (uint32_t y = 0; y < extent.y; y++) {
+            size_t grid_index = (size_t)(origin.z + z) * dimensions.y * dimensions.x + (size_t)(origin.y + y) * dimensions.x + origin.x;
+            std::memcpy(chunk, grid + grid_index, extent.x);
+            chunk += extent.x;
+        }
+    }
+}
+
+void ChunkGrid::scatter(const uint8_t* chunk, uint32_t index, uint8_t* grid) const {
+    scatterLayers(chunk, index, 0, dimensions.z, grid);
+}
+
+void ChunkGrid::scatterLayers(const uint8_t* chunk, uint32_t index, uint32_t z_begin, uint32_t z_end, uint8_t* layers) const {
+    glm::uvec3 origin = chunkOrigin(index);
+    glm::uvec3 extent = chunkExtent(index);
+    uint32_t first = std::max(z_begin, origin.z);
+    uint32_t last = std::min(z_end, origin.z + extent.z);
+
+    chunk += (size_t)(first - origin.z) * extent.y * extent.x;
+    for (uint32_t z = first; z < last; z++) {
+        for (uint32_t y = 0; y < extent.y; y++) {
+            size_t grid_index = (size_t)(z - z_begin) * dimensions.y * dimensions.x + (size_t)(origin.y + y) * dimensions.x + origin.x;
+            std::memcpy(layers + grid_index, chunk, extent.x);
+            chunk += extent.x;
+        }
+    }
+}
+
+void parseChunkedHeader(const uint8_t* bytes, ChunkedStateHeader& header) {
+    if (std::memcmp(bytes, STATE_MAGIC_V2, 4)) {
+        throw std::runtime_error("Invalid file magic!");
+    }
+
+    std::memcpy(&header.version, bytes + 4, 2);
+    std::memcpy(&header.chunk_size, bytes + 6, 2);
+    std::memcpy(&header.x_size, bytes + 8, 4);
+    std::memcpy(&header.y_size, bytes + 12, 4);
+    std::memcpy(&header.z_size, bytes + 16, 4);
+    std::memcpy(&header.codec, bytes + 20, 1);
+    std::memcpy(&header.flags, bytes + 21, 1);
+    std::memcpy(&header.chunk_count, bytes + 24, 4);
+
+    if (header.version != STATE_VERSION_V2) {
+        throw std::runtime_error("Unsupported state file version " + std::to_string(header.version) + "!");
+    }
+}
+
+void parseChunkEntry(const uint8_t* bytes, ChunkEntry& entry) {
+    std::memcpy(&entry.offset, bytes, 8);
+    std::memcpy(&entry.compressed_size, bytes + 8, 4);
+    std::memcpy(&entry.checksum, bytes + 12, 4);
+    std::memcpy(&entry.codec, bytes + 16, 1);
+}
+
+void serializeChunkedHeader(const ChunkedStateHeader& header, uint8_t* bytes) {
+    std::memcpy(bytes, STATE_MAGIC_V2, 4);
+    std::memcpy(bytes + 4, &header.version, 2);
+    std::memcpy(bytes + 6, &header.chunk_size, 2);
+    std::memcpy(bytes + 8, &header.x_size, 4);
+    std::memcpy(bytes + 12, &header.y_size, 4);
+    std::memcpy(bytes + 16, &header.z_size, 4);
+    std::memcpy(bytes + 20, &header.codec, 1);
+    std::memcpy(bytes + 21, &header.flags, 1);
+    std::memset(bytes + 22, 0, 2);
+    std::memcpy(bytes + 24, &header.chunk_count, 4);
+}
+
+void serializeChunkEntry(const ChunkEntry& entry, uint8_t* bytes) {
+    std::memcpy(bytes, &entry.offset, 8);
+    std::memcpy(bytes + 8, &entry.compressed_size, 4);
+    std::memcpy(bytes + 12, &entry.checksum, 4);
+    std::memcpy(bytes + 16, &entry.codec, 1);
+    std::memset(bytes + 17, 0, 3);
+}
+
+void readChunkedHeader(std::istream& file, ChunkedStateHeader& header) {
+    uint8_t bytes[STATE_V2_HEADER_SIZE];
+    file.read((char*)bytes, STATE_V2_HEADER_SIZE);
+
+    if (!file) {
+        throw std::runtime_error("Truncated state header!");
+    }
+    parseChunkedHeader(bytes, header);
+}
+
+void writeChunkedHeader(std::ostream& file, const ChunkedStateHeader& header) {
+    uint8_t bytes[STATE_V2_HEADER_SIZE];
+    serializeChunkedHeader(header, bytes);
+    file.write((char*)bytes, STATE_V2_HEADER_SIZE);
+}
+
+void readChunkEntry(std::istream& file, ChunkEntry& entry) {
+    uint8_t bytes[STATE_V2_ENTRY_SIZE];
+    file.read((char*)bytes, STATE_V2_ENTRY_SIZE);
+    parseChunkEntry(bytes, entry);
+}
+
+void writeChunkEntry(std::ostream& file, const ChunkEntry& entry) {
+    uint8_t bytes[STATE_V2_ENTRY_SIZE];
+    serializeChunkEntry(entry, bytes);
+    file.write((char*)bytes, STATE_V2_ENTRY_SIZE);
+}
+
+ChunkEntry encodeChunk(const uint8_t* chunk, size_t size, ChunkCodecType codec, std::vector<uint8_t>& payload, ChunkChecksumType checksum) {
+    ChunkEntry entry{};
+    size_t start = payload.size();
+    if (size > 0 && isUniform(chunk, size)) {
+        codec = ChunkCodecType::UNIFORM;
+    }
+    getChunkCodec(codec).encode(chunk, size, payload);
+    entry.codec = codec;
+
+    if (codec != ChunkCodecType::RAW && payload.size() - start >= size) {
+        payload.resize(start);
+        getChunkCodec(ChunkCodecType::RAW).encode(chunk, size, payload);
+        entry.codec = ChunkCodecType::RAW;
+    }
+
+    entry.compressed_size = payload.size() - start;
+    entry.checksum = chunkChecksum(payload.data() + start, entry.compressed_size, checksum);
+    return entry;
+}
+
+void decodeChunk(const ChunkEntry& entry, const uint8_t* payload, uint8_t* chunk, size_t size, ChunkChecksumType checksum) {
+    if (chunkChecksum(payload, entry.compressed_size, checksum) != entry.checksum) {
+        throw std::runtime_error("Chunk checksum mismatch!");
+    }
+    getChunkCodec(entry.codec).decode(payload, entry.compressed_size, chunk, size);
+}
+
+void decodeChunkVoxels(const ChunkEntry& entry, const uint8_t* payload, VoxelPacking packing,
+                       uint8_t* chunk, size_t volume, std::vector<uint8_t>& scratch, ChunkChecksumType checksum) {
+    if (packing == VoxelPacking::BYTE) {
+        decodeChunk(entry, payload, chunk, volume, checksum);
+        return;
+    }
+
+    scratch.resize(packedSize(volume, packing));
+    decodeChunk(entry, payload, scratch.data(), scratch.size(), checksum);
+    unpackNibbles(scratch.data(), volume, chunk);
+}
+
+size_t PayloadDeduplicator::KeyHash::operator()(const Key& key) const {
+    return key.content_hash ^ ((size_t)key.size << 8) ^ (size_t)key.codec;
+}
+
+bool PayloadDeduplicator::place(ChunkEntry& entry, uint64_t content_hash, const uint8_t* payload, uint64_t offset) {
+    Key key{content_hash, entry.compressed_size, entry.codec};
+    auto inserted = offsets.emplace(key, offset);
+    if (!inserted.second) {
+        stored_payload.resize(entry.compressed_size);
+        read_payload(inserted.first->second, stored_payload.data(), stored_payload.size());
+        if (std::memcmp(stored_payload.data(), payload, entry.compressed_size) == 0) {
+            entry.offset = inserted.first->second;
+            return false;
+        }
+    }
+    entry.offset = offset;
+    return true;
+}
+
+static void pwriteAll(int fd, const uint8_t* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        } else if (written <= 0) {
+            throw std::runtime_error("Failed to write state file!");
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+}
+
+static void preadAll(int fd, uint8_t* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t read = pread(fd, data, size, offset);
+        if (read < 0 && errno == EINTR) {
+            continue;
+        } else if (read < 0) {
+            throw std::runtime_error("Failed to read state file!");
+        } else if (read == 0) {
+            throw std::runtime_error("Truncated state file!");
+        }
+        data += read;
+        size -= read;
+        offset += read;
+    }
+}
+
+static std::string chunkName(const ChunkGrid& grid, uint32_t index) {
+    glm::uvec3 origin = grid.chunkOrigin(index);
+    return "chunk " + std::to_string(index) + " at (" + std::to_string(origin.x) + ", "
+        + std::to_string(origin.y) + ", " + std::to_string(origin.z) + ")";
+}
+
+void writeChunkedState(std::string path, glm::uvec3 dimensions, const uint8_t* grid, uint16_t chunk_size, ChunkCodecType codec, VoxelPacking packing, ThreadPool& pool) {
+    ChunkGrid chunk_grid{dimensions, chunk_size};
+    writeChunkedState(path, dimensions, chunk_size, codec, [&](uint32_t index, uint8_t* scratch) {
+        chunk_grid.gather(grid, index, scratch);
+        return (const uint8_t*)scratch;
+    }, packing, pool);
+}
+
+void writeChunkedState(std::string path, glm::uvec3 dimensions, uint16_t chunk_size, ChunkCodecType codec, const ChunkSource& source, VoxelPacking packing, ThreadPool& pool) {
+    ChunkGrid chunk_grid{dimensions, chunk_size};
+    if (chunk_grid.chunkCount() == 0) {
+        throw std::runtime_error("State struct contains no data!");
+    }
+
+    // Read too, deduplication compares against payloads already written
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    ChunkedStateHeader header{};
+    header.chunk_size = chunk_size;
+    header.x_size = dimensions.x;
+    header.y_size = dimensions.y;
+    header.z_size = dimensions.z;
+    header.codec = codec;
+    header.flags = STATE_FLAG_XXH32_CHECKSUM;
+    if (packing == VoxelPacking::NIBBLE) {
+        header.flags |= STATE_FLAG_PACKED_4BIT;
+    }
+    header.chunk_count = chunk_grid.chunkCount();
+    ChunkChecksumType checksum = header.getChecksumType();
+
+    // Payloads go straight after the directory, which is filled in once all offsets are known
+    std::vector<ChunkEntry> entries(header.chunk_count);
+    uint64_t offset = STATE_V2_HEADER_SIZE + (uint64_t)header.chunk_count * STATE_V2_ENTRY_SIZE;
+
+    // Each task encodes a run of chunks into its own buffer. A run's file offset
+    // is only known once every run before it is encoded, so runs are encoded a
+    // batch at a time, placed, then written in parallel. Placing also drops any
+    // payload that is already in the file.
+    unsigned workers = pool.getThreadCount();
+    uint32_t task_count = (header.chunk_count + STATE_CHUNKS_PER_TASK - 1) / STATE_CHUNKS_PER_TASK;
+    uint32_t batch_size = workers * 4;
+    size_t chunk_volume = (size_t)chunk_size * chunk_size * chunk_size;
+    std::vector<std::vector<uint8_t>> payloads(batch_size);
+    std::vector<uint64_t> payload_offsets(batch_size);
+    std::vector<uint64_t> local_offsets(batch_size * STATE_CHUNKS_PER_TASK);
+    std::vector<uint64_t> content_hashes(batch_size * STATE_CHUNKS_PER_TASK);
+    std::vector<uint8_t> stored(batch_size * STATE_CHUNKS_PER_TASK);
+    std::vector<std::vector<uint8_t>> chunks(workers, std::vector<uint8_t>(chunk_volume));
+    std::vector<std::vector<uint8_t>> packed(workers, std::vector<uint8_t>(packedSize(chunk_volume, packing)));
+    // Payloads placed this batch are still in memory, the rest are in the file
+    uint64_t batch_offset = offset;
+    std::unordered_map<uint64_t, const uint8_t*> batch_payloads;
+    PayloadDeduplicator deduplicator{[&](uint64_t payload_offset, uint8_t* data, size_t size) {
+        if (payload_offset >= batch_offset) {
+            std::memcpy(data, batch_payloads.at(payload_offset), size);
+        } else {
+            preadAll(fd, data, size, payload_offset);
+        }
+    }};
+
+    try {
+        for (uint32_t batch_first = 0; batch_first < task_count; batch_first += batch_size) {
+            uint32_t batch_count = std::min(batch_size, task_count - batch_first);
+
+            pool.parallelFor(batch_count, [&](uint32_t task, unsigned worker) {
+                std::vector<uint8_t>& payload = payloads[task];
+                payload.clear();
+
+                uint32_t first = (batch_first + task) * STATE_CHUNKS_PER_TASK;
+                uint32_t last = std::min(first + STATE_CHUNKS_PER_TASK, header.chunk_count);
+                for (uint32_t i = first; i < last; i++) {
+                    size_t volume = chunk_grid.chunkVolume(i);
+                    const uint8_t* voxels = source(i, chunks[worker].data());
+
+                    if (packing == VoxelPacking::NIBBLE) {
+                        if (!fitsNibbles(voxels, volume)) {
+                            throw std::runtime_error("Chunk " + std::to_string(i) + " has voxels that don't fit in 4 bits!");
+                        }
+                        packNibbles(voxels, volume, packed[worker].data());
+                        voxels = packed[worker].data();
+                        volume = packedSize(volume, packing);
+                    }
+
+                    size_t slot = (size_t)task * STATE_CHUNKS_PER_TASK + (i - first);
+                    local_offsets[slot] = payload.size();
+                    entries[i] = encodeChunk(voxels, volume, codec, payload, checksum);
+                    content_hashes[slot] = chunkContentHash(payload.data() + local_offsets[slot], entries[i].compressed_size);
+                }
+            });
+
+            batch_offset = offset;
+            batch_payloads.clear();
+            for (uint32_t task = 0; task < batch_count; task++) {
+                uint32_t first = (batch_first + task) * STATE_CHUNKS_PER_TASK;
+                uint32_t last = std::min(first + STATE_CHUNKS_PER_TASK, header.chunk_count);
+                payload_offsets[task] = offset;
+                for (uint32_t i = first; i < last; i++) {
+                    size_t slot = (size_t)task * STATE_CHUNKS_PER_TASK + (i - first);
+                    const uint8_t* payload = payloads[task].data() + local_offsets[slot];
+                    stored[slot] = deduplicator.place(entries[i], content_hashes[slot], payload, offset);
+                    if (stored[slot]) {
+                        batch_payloads.emplace(offset, payload);
+                        offset += entries[i].compressed_size;
+                    }
+                }
+            }
+
+            pool.parallelFor(batch_count, [&](uint32_t task, unsigned worker) {
+                // Squeeze out the payloads that were already stored
+                std::vector<uint8_t>& payload = payloads[task];
+                uint32_t first = (batch_first + task) * STATE_CHUNKS_PER_TASK;
+                uint32_t last = std::min(first + STATE_CHUNKS_PER_TASK, header.chunk_count);
+                size_t size = 0;
+                for (uint32_t i = first; i < last; i++) {
+                    size_t slot = (size_t)task * STATE_CHUNKS_PER_TASK + (i - first);
+                    if (stored[slot]) {
+                        std::memmove(payload.data() + size, payload.data() + local_offsets[slot], entries[i].compressed_size);
+                        size += entries[i].compressed_size;
+                    }
+                }
+                pwriteAll(fd, payload.data(), size, payload_offsets[task]);
+            });
+        }
+
+        std::vector<uint8_t> directory(STATE_V2_HEADER_SIZE + (size_t)header.chunk_count * STATE_V2_ENTRY_SIZE);
+        serializeChunkedHeader(header, directory.data());
+        for (uint32_t i = 0; i < header.chunk_count; i++) {
+            serializeChunkEntry(entries[i], directory.data() + STATE_V2_HEADER_SIZE + (size_t)i * STATE_V2_ENTRY_SIZE);
+        }
+        pwriteAll(fd, directory.data(), directory.size(), 0);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+
+    if (close(fd) != 0) {
+        throw std::runtime_error("Failed to write state file!");
+    }
+}
+
+ChunkedStateReader::ChunkedStateReader(std::string path) : fd{open(path.c_str(), O_RDONLY)} {
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    try {
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) != 0) {
+            throw std::runtime_error("Failed to stat file!");
+        }
+        file_size = file_stat.st_size;
+
+        if (file_size < STATE_V2_HEADER_SIZE) {
+            throw std::runtime_error("Truncated state header!");
+        }
+        uint8_t header_bytes[STATE_V2_HEADER_SIZE];
+        preadAll(fd, header_bytes, STATE_V2_HEADER_SIZE, 0);
+        parseChunkedHeader(header_bytes, header);
+        grid = ChunkGrid{glm::uvec3{header.x_size, header.y_size, header.z_size}, header.chunk_size};
+
+        if (grid.chunkCount() == 0) {
+            throw std::runtime_error("File contains no data!");
+        } else if (grid.chunkCount() != header.chunk_count) {
+            throw std::runtime_error("Chunk directory doesn't match size values!");
+        }
+
+        uint64_t directory_size = (uint64_t)header.chunk_count * STATE_V2_ENTRY_SIZE;
+        if (STATE_V2_HEADER_SIZE + directory_size > file_size) {
+            throw std::runtime_error("Truncated chunk directory!");
+        }
+        std::vector<uint8_t> directory(directory_size);
+        preadAll(fd, directory.data(), directory.size(), STATE_V2_HEADER_SIZE);
+
+        entries.resize(header.chunk_count);
+        for (uint32_t i = 0; i < header.chunk_count; i++) {
+            parseChunkEntry(directory.data() + (size_t)i * STATE_V2_ENTRY_SIZE, entries[i]);
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+}
+
+ChunkedStateReader::~ChunkedStateReader() {
+    close(fd);
+}
+
+SharedPayloadCache::SharedPayloadCache(const std::vector<ChunkEntry>& entries, const std::function<bool(const ChunkEntry&)>& in_file) :
+    is_shared(entries.size())
+{
+    // Payloads are placed in chunk order, so one starting before the end of
+    // everything stored so far was placed for an earlier chunk
+    std::unordered_map<uint64_t, uint32_t> slots;
+    std::vector<uint32_t> owners;
+    std::vector<uint32_t> uses;
+    uint64_t frontier = 0;
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        const ChunkEntry& entry = entries[i];
+        if (entry.offset < frontier && in_file(entry)) {
+            auto slot = slots.emplace(entry.offset, owners.size());
+            if (slot.second) {
+                owners.push_back(i);
+                uses.push_back(0);
+            }
+            uses[slot.first->second]++;
+            is_shared[i] = 1;
+        } else {
+            frontier = std::max(frontier, entry.offset + entry.compressed_size);
+        }
+    }
+
+    std::vector<uint32_t> by_use(owners.size());
+    for (uint32_t i = 0; i < by_use.size(); i++) {
+        by_use[i] = i;
+    }
+    std::sort(by_use.begin(), by_use.end(), [&](uint32_t a, uint32_t b) { return uses[a] > uses[b]; });
+
+    payloads.resize(owners.size());
+    for (uint32_t rank = 0; rank < by_use.size(); rank++) {
+        uint32_t owner = owners[by_use[rank]];
+        payloads[rank].owner = owner;
+        ranks[entries[owner].offset] = rank;
+    }
+}
+
+bool sharesPayload(const ChunkEntry& entry, const ChunkEntry& owner) {
+    return owner.compressed_size == entry.compressed_size && owner.checksum == entry.checksum && owner.codec == entry.codec;
+}
+
+bool ChunkedStateReader::inFile(const ChunkEntry& entry) const {
+    return entry.offset <= file_size && entry.compressed_size <= file_size - entry.offset;
+}
+
+void ChunkedStateReader::readChunk(uint32_t index, uint8_t* chunk) {
+    if (index >= entries.size()) {
+        throw std::runtime_error("Chunk index out of range!");
+    }
+
+    const ChunkEntry& entry = entries[index];
+    if (!inFile(entry)) {
+        throw std::runtime_error("Corrupt " + chunkName(grid, index) + ": payload lies outside the file!");
+    }
+    payload.resize(entry.compressed_size);
+    preadAll(fd, payload.data(), entry.compressed_size, entry.offset);
+
+    try {
+        decodeChunkVoxels(entry, payload.data(), header.getPacking(), chunk, grid.chunkVolume(index), packed, header.getChecksumType());
+    } catch (const std::runtime_error& e) {
+        throw std::runtime_error("Corrupt " + chunkName(grid, index) + ": " + e.what());
+    }
+}
+
+void ChunkedStateReader::readAll(uint8_t* world, ThreadPool& pool) {
+    readLayers(0, grid.dimensions.z, world, pool);
+}
+
+void ChunkedStateReader::loadSharedPayloads(ThreadPool& pool) {
+    VoxelPacking packing = header.getPacking();
+    ChunkChecksumType checksum = header.getChecksumType();
+    std::vector<std::vector<uint8_t>> scratch(pool.getThreadCount());
+
+    // Deduplicated chunks point back at a payload stored earlier in the file.
+    // Those payloads are read and verified once, and the most used ones are
+    // kept decoded so their chunks are only scattered.
+    shared = SharedPayloadCache{entries, [&](const ChunkEntry& entry) { return inFile(entry); }};
+    pool.parallelFor(shared.size(), [&](uint32_t rank, unsigned worker) {
+        SharedPayload& cached = shared[rank];
+        const ChunkEntry& entry = entries[cached.owner];
+        cached.payload.resize(entry.compressed_size);
+        preadAll(fd, cached.payload.data(), entry.compressed_size, entry.offset);
+
+        try {
+            size_t volume = grid.chunkVolume(cached.owner);
+            if (shared.keepsDecoded(rank)) {
+                cached.voxels.resize(volume);
+                decodeChunkVoxels(entry, cached.payload.data(), packing, cached.voxels.data(), volume, scratch[worker], checksum);
+            } else if (chunkChecksum(cached.payload.data(), entry.compressed_size, checksum) != entry.checksum) {
+                throw std::runtime_error("Chunk checksum mismatch!");
+            }
+        } catch (const std::runtime_error& e) {
+            cached.error = e.what();
+            cached.voxels.clear();
+        }
+    });
+    shared_loaded = true;
+}
+
+void ChunkedStateReader::readLayers(uint32_t z_begin, uint32_t z_count, uint8_t* layers, ThreadPool& pool) {
+    struct Corruption {
+        uint32_t index;
+        std::string reason;
+    };
+
+    if ((uint64_t)z_begin + z_count > grid.dimensions.z) {
+        throw std::runtime_error("Layer range outside of the world!");
+    }
+    if (!shared_loaded) {
+        loadSharedPayloads(pool);
+    }
+
+    uint32_t z_end = z_begin + z_count;
+    uint32_t chunk_layers = grid.counts.x * grid.counts.y;
+    uint32_t first_chunk = (z_begin / grid.chunk_size) * chunk_layers;
+    uint32_t last_chunk = ((z_end + grid.chunk_size - 1) / grid.chunk_size) * chunk_layers;
+
+    unsigned workers = pool.getThreadCount();
+    size_t chunk_volume = (size_t)grid.chunk_size * grid.chunk_size * grid.chunk_size;
+    std::vector<std::vector<uint8_t>> payloads(workers);
+    std::vector<std::vector<uint8_t>> chunks(workers, std::vector<uint8_t>(chunk_volume));
+    std::vector<std::vector<uint8_t>> scratch(workers);
+    std::vector<Corruption> corrupt;
+    std::mutex corrupt_mutex;
+
+    VoxelPacking packing = header.getPacking();
+    ChunkChecksumType checksum = header.getChecksumType();
+
+    uint32_t task_count = (last_chunk - first_chunk + STATE_CHUNKS_PER_TASK - 1) / STATE_CHUNKS_PER_TASK;
+    pool.parallelFor(task_count, [&](uint32_t task, unsigned worker) {
+        uint32_t first = first_chunk + task * STATE_CHUNKS_PER_TASK;
+        uint32_t last = std::min(first + STATE_CHUNKS_PER_TASK, last_chunk);
+        auto markCorrupt = [&](uint32_t index, std::string reason) {
+            std::lock_guard<std::mutex> lock(corrupt_mutex);
+            corrupt.push_back({index, reason});
+        };
+
+        // Files written here keep a run's own payloads back to back, so they
+        // are normally fetched with a single read
+        uint64_t begin = UINT64_MAX;
+        uint64_t end = 0;
+        uint64_t total = 0;
+        for (uint32_t i = first; i < last; i++) {
+            if (shared.isShared(i) || !inFile(entries[i])) {
+                continue;
+            }
+            begin = std::min(begin, entries[i].offset);
+            end = std::max(end, entries[i].offset + entries[i].compressed_size);
+            total += entries[i].compressed_size;
+        }
+
+        std::vector<uint8_t>& payload = payloads[worker];
+        bool spanned = begin < end && end - begin <= total * 2;
+        if (spanned) {
+            payload.resize(end - begin);
+            preadAll(fd, payload.data(), payload.size(), begin);
+        }
+
+        for (uint32_t i = first; i < last; i++) {
+            const ChunkEntry& entry = entries[i];
+            size_t volume = grid.chunkVolume(i);
+            if (!inFile(entry)) {
+                markCorrupt(i, "payload lies outside the file");
+                continue;
+            }
+
+            const uint8_t* data;
+            if (shared.isShared(i)) {
+                const SharedPayload& cached = shared[shared.rank(entry.offset)];
+                if (!sharesPayload(entry, entries[cached.owner])) {
+                    markCorrupt(i, "shares a payload with chunk " + std::to_string(cached.owner) + " but doesn't match it");
+                    continue;
+                } else if (!cached.error.empty()) {
+                    markCorrupt(i, cached.error);
+                    continue;
+                } else if (cached.voxels.size() == volume) {
+                    grid.scatterLayers(cached.voxels.data(), i, z_begin, z_end, layers);
+                    continue;
+                }
+                data = cached.payload.data();
+            } else if (spanned) {
+                data = payload.data() + (entry.offset - begin);
+            } else {
+                payload.resize(entry.compressed_size);
+                preadAll(fd, payload.data(), entry.compressed_size, entry.offset);
+                data = payload.data();
+            }
+
+            try {
+                decodeChunkVoxels(entry, data, packing, chunks[worker].data(), volume, scratch[worker], checksum);
+            } catch (const std::runtime_error& e) {
+                markCorrupt(i, e.what());
+                continue;
+            }
+            grid.scatterLayers(chunks[worker].data(), i, z_begin, z_end, layers);
+        }
+    });
+
+    if (corrupt.empty()) {
+        return;
+    }
+
+    std::sort(corrupt.begin(), corrupt.end(), [](const Corruption& a, const Corruption& b) { return a.index < b.index; });
+    std::string message = std::to_string(corrupt.size()) + " corrupt chunk(s) in state file:";
+    for (size_t i = 0; i < corrupt.size() && i < STATE_MAX_REPORTED_CHUNKS; i++) {
+        message += "\n    " + chunkName(grid, corrupt[i].index) + ": " + corrupt[i].reason;
+    }
+    if (corrupt.size() > STATE_MAX_REPORTED_CHUNKS) {
+        message += "\n    and " + std::to_string(corrupt.size() - STATE_MAX_REPORTED_CHUNKS) + " more";
+    }
+    throw std::runtime_error(message);
+}
+
+}
+}
@@ -0,0 +1,227 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <functional>
+#include <unordered_map>
+#include <stdint.h>
+#include "glm/glm.hpp"
+#include "files/chunk_codec.h"
+#include "files/voxel_packing.h"
+#include "threading/thread_pool.h"
+
+#define STATE_MAGIC_V2 "CCS2"
+#define STATE_VERSION_V2 2
+#define STATE_DEFAULT_CHUNK_SIZE 16
+#define STATE_V2_HEADER_SIZE 28
+#define STATE_V2_ENTRY_SIZE 20
+
+// Header flags
+#define STATE_FLAG_PACKED_4BIT 0x01
+#define STATE_FLAG_XXH32_CHECKSUM 0x02
+
+// Chunks handed to one pool task, payloads of a task are written / read with a single call
+#define STATE_CHUNKS_PER_TASK 64
+// Corrupt chunks listed by name when a read fails, the rest are only counted
+#define STATE_MAX_REPORTED_CHUNKS 16
+// Shared payloads kept decoded while loading, 4 MiB worth of 16^3 chunks
+#define STATE_DECODE_CACHE_CHUNKS 1024
+
+namespace cscd {
+namespace file {
+
+struct ChunkedStateHeader {
+    uint16_t version = STATE_VERSION_V2;
+    uint16_t chunk_size = STATE_DEFAULT_CHUNK_SIZE;
+    uint32_t x_size = 0;
+    uint32_t y_size = 0;
+    uint32_t z_size = 0;
+    ChunkCodecType codec = ChunkCodecType::RLE;
+    uint8_t flags = 0;
+    uint32_t chunk_count = 0;
+
+    VoxelPacking getPacking() const { return (flags & STATE_FLAG_PACKED_4BIT) ? VoxelPacking::NIBBLE : VoxelPacking::BYTE; }
+    ChunkChecksumType getChecksumType() const { return (flags & STATE_FLAG_XXH32_CHECKSUM) ? ChunkChecksumType::XXH32 : ChunkChecksumType::FNV1A; }
+};
+
+struct ChunkEntry {
+    uint64_t offset = 0;
+    uint32_t compressed_size = 0;
+    uint32_t checksum = 0;
+    ChunkCodecType codec = ChunkCodecType::RAW;
+};
+
+// Splits a world into chunk_size^3 chunks (clamped at the far edges). Chunks
+// are numbered in the same z, y, x order as voxels, and a chunk's voxels are
+// stored in that order too.
+struct ChunkGrid {
+    glm::uvec3 dimensions;
+    uint32_t chunk_size;
+    glm::uvec3 counts;
+
+    ChunkGrid(glm::uvec3 dimensions_, uint32_t chunk_size_);
+
+    uint32_t chunkCount() const { return counts.x * counts.y * counts.z; }
+    uint32_t chunkIndex(glm::uvec3 chunk) const { return chunk.z * counts.y * counts.x + chunk.y * counts.x + chunk.x; }
+    glm::uvec3 chunkCoords(uint32_t index) const;
+    glm::uvec3 chunkOrigin(uint32_t index) const { return chunkCoords(index) * chunk_size; }
+    glm::uvec3 chunkExtent(uint32_t index) const;
+    size_t chunkVolume(uint32_t index) const;
+
+    void gather(const uint8_t* grid, uint32_t index, uint8_t* chunk) const;
+    void scatter(const uint8_t* chunk, uint32_t index, uint8_t* grid) const;
+    // Only writes the chunk's voxels in layers [z_begin, z_end), layers points at layer z_begin
+    void scatterLayers(const uint8_t* chunk, uint32_t index, uint32_t z_begin, uint32_t z_end, uint8_t* layers) const;
+};
+
+// Parse the on-disk layout from memory, bytes must hold a whole header / entry
+void parseChunkedHeader(const uint8_t* bytes, ChunkedStateHeader& header);
+void parseChunkEntry(const uint8_t* bytes, ChunkEntry& entry);
+void serializeChunkedHeader(const ChunkedStateHeader& header, uint8_t* bytes);
+void serializeChunkEntry(const ChunkEntry& entry, uint8_t* bytes);
+
+void readChunkedHeader(std::istream& file, ChunkedStateHeader& header);
+void writeChunkedHeader(std::ostream& file, const ChunkedStateHeader& header);
+void readChunkEntry(std::istream& file, ChunkEntry& entry);
+void writeChunkEntry(std::ostream& file, const ChunkEntry& entry);
+
+// Encodes one chunk with the preferred codec, falling back to RAW when that
+// doesn't make it any smaller. Uniform chunks always use UNIFORM.
+// The payload is appended to payload, entry.offset is left for the caller.
+ChunkEntry encodeChunk(const uint8_t* chunk, size_t size, ChunkCodecType codec, std::vector<uint8_t>& payload,
+                       ChunkChecksumType checksum = ChunkChecksumType::FNV1A);
+void decodeChunk(const ChunkEntry& entry, const uint8_t* payload, uint8_t* chunk, size_t size,
+                 ChunkChecksumType checksum = ChunkChecksumType::FNV1A);
+// Decodes a chunk stored with the given packing back to one byte per voxel
+void decodeChunkVoxels(const ChunkEntry& entry, const uint8_t* payload, VoxelPacking packing,
+                       uint8_t* chunk, size_t volume, std::vector<uint8_t>& scratch,
+                       ChunkChecksumType checksum = ChunkChecksumType::FNV1A);
+
+// Reads back size bytes of a payload placed earlier at offset
+using PayloadReader = std::function<void(uint64_t offset, uint8_t* data, size_t size)>;
+
+// Lets identical payloads share one copy in a file. Payloads are matched on
+// codec, size and a 64 bit content hash, then compared byte for byte against
+// the stored copy, so a hash collision is stored on its own instead.
+class PayloadDeduplicator {
+public:
+    PayloadDeduplicator(PayloadReader read_payload_) : read_payload{std::move(read_payload_)} {}
+
+    // Points entry at an identical payload placed earlier and returns false, or
+    // remembers the payload at offset and returns true if it needs storing
+    bool place(ChunkEntry& entry, uint64_t content_hash, const uint8_t* payload, uint64_t offset);
+
+private:
+    struct Key {
+        uint64_t content_hash;
+        uint32_t size;
+        ChunkCodecType codec;
+
+        bool operator==(const Key& other) const {
+            return content_hash == other.content_hash && size == other.size && codec == other.codec;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    PayloadReader read_payload;
+    std::unordered_map<Key, uint64_t, KeyHash> offsets;
+    std::vector<uint8_t> stored_payload;
+};
+
+// A payload that deduplicated chunks point back at, owner being the chunk that
+// stores it. voxels is left empty when the payload isn't kept decoded.
+struct SharedPayload {
+    uint32_t owner;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> voxels;
+    std::string error;
+};
+
+// Finds the payloads shared by deduplicated chunks, keyed by their offset, so
+// readers verify and decode each of them once. Payloads are ranked by how many
+// chunks use them and the first STATE_DECODE_CACHE_CHUNKS are kept decoded.
+class SharedPayloadCache {
+public:
+    SharedPayloadCache() = default;
+    // Entries in_file rejects are never treated as shared
+    SharedPayloadCache(const std::vector<ChunkEntry>& entries, const std::function<bool(const ChunkEntry&)>& in_file);
+
+    bool isShared(uint32_t index) const { return is_shared[index]; }
+    size_t size() const { return payloads.size(); }
+    uint32_t rank(uint64_t offset) const { return ranks.at(offset); }
+    bool keepsDecoded(uint32_t rank) const { return rank < STATE_DECODE_CACHE_CHUNKS; }
+    SharedPayload& operator[](uint32_t rank) { return payloads[rank]; }
+
+private:
+    std::unordered_map<uint64_t, uint32_t> ranks;
+    std::vector<SharedPayload> payloads;
+    std::vector<uint8_t> is_shared;
+};
+
+// Whether entry can be served from the payload stored for owner
+bool sharesPayload(const ChunkEntry& entry, const ChunkEntry& owner);
+
+// Provides the voxels of chunk index, either by filling scratch or by returning
+// a pointer to data that is already laid out as a chunk. Called from the pool's
+// workers, each with its own scratch.
+using ChunkSource = std::function<const uint8_t*(uint32_t index, uint8_t* scratch)>;
+
+// Sources always provide one byte per voxel, NIBBLE packing is applied per chunk
+// before encoding and throws if a voxel doesn't fit. Chunks are encoded on the
+// pool and written with pwrite, STATE_CHUNKS_PER_TASK at a time.
+void writeChunkedState(std::string path, glm::uvec3 dimensions, const uint8_t* grid,
+                       uint16_t chunk_size = STATE_DEFAULT_CHUNK_SIZE,
+                       ChunkCodecType codec = ChunkCodecType::RLE,
+                       VoxelPacking packing = VoxelPacking::BYTE,
+                       ThreadPool& pool = sharedThreadPool());
+void writeChunkedState(std::string path, glm::uvec3 dimensions, uint16_t chunk_size,
+                       ChunkCodecType codec, const ChunkSource& source,
+                       VoxelPacking packing = VoxelPacking::BYTE,
+                       ThreadPool& pool = sharedThreadPool());
+
+// Random access reader, any chunk can be decoded without touching the others.
+// Payloads are read with pread, so readAll / readLayers can decode on every
+// pool worker at once. Payloads shared by deduplicated chunks are only read
+// and decoded once. Chunks failing their checksum are all collected before
+// throwing, so the error names every corrupt chunk rather than just the first.
+class ChunkedStateReader {
+public:
+    ChunkedStateReader(std::string path);
+    ~ChunkedStateReader();
+
+    ChunkedStateReader(const ChunkedStateReader&) = delete;
+    ChunkedStateReader& operator=(const ChunkedStateReader&) = delete;
+
+    const ChunkedStateHeader& getHeader() const { return header; }
+    const ChunkGrid& getGrid() const { return grid; }
+    const ChunkEntry& getEntry(uint32_t index) const { return entries[index]; }
+    glm::uvec3 getDimensions() const { return grid.dimensions; }
+
+    void readChunk(uint32_t index, uint8_t* chunk);
+    void readAll(uint8_t* world, ThreadPool& pool = sharedThreadPool());
+    // Decodes layers [z_begin, z_begin + z_count), whole chunk layers keep every chunk to a single decode
+    void readLayers(uint32_t z_begin, uint32_t z_count, uint8_t* layers, ThreadPool& pool = sharedThreadPool());
+
+private:
+    bool inFile(const ChunkEntry& entry) const;
+    // Done on the first read, shared payloads are kept for the ones after it
+    void loadSharedPayloads(ThreadPool& pool);
+
+    int fd = -1;
+    uint64_t file_size = 0;
+    ChunkedStateHeader header;
+    ChunkGrid grid{glm::uvec3{0, 0, 0}, STATE_DEFAULT_CHUNK_SIZE};
+    std::vector<ChunkEntry> entries;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> packed;
+    SharedPayloadCache shared;
+    bool shared_loaded = false;
+};
+
+}
+}
@@ -0,0 +1,274 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "generation_cache.h"
+
+namespace cscd {
+namespace file {
+
+uint64_t GenerationKey::hash() const {
+    uint8_t bytes[35];
+    std::memcpy(bytes, &type, 1);
+    std::memcpy(bytes + 1, &terrain.seed, 4);
+    std::memcpy(bytes + 5, &terrain.octaves, 4);
+    std::memcpy(bytes + 9, &terrain.terrain_ratio, 4);
+    std::memcpy(bytes + 13, &terrain.frequency, 4);
+    std::memcpy(bytes + 17, &dimensions.x, 4);
+    std::memcpy(bytes + 21, &dimensions.y, 4);
+    std::memcpy(bytes + 25, &dimensions.z, 4);
+    std::memcpy(bytes + 29, &chunk_size, 2);
+    // Bumped whenever a generator's output changes, so stale worlds are never reused
+    uint32_t generator_version = 1;
+    std::memcpy(bytes + 31, &generator_version, 4);
+    return chunkContentHash(bytes, sizeof(bytes));
+}
+
+std::string GenerationKey::name() const {
+    char text[17];
+    std::snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash());
+    return text;
+}
+
+// Terrain heights of one chunk column's x, z footprint, sampled by the first of
+// its chunks to be generated and dropped once every chunk in it has been visited
+struct ColumnHeights {
+    std::once_flag sampled;
+    std::vector<int> heights;
+    std::atomic<uint32_t> remaining{0};
+};
+
+static void generateChunk(const GenerationKey& key, const ChunkGrid& grid, uint32_t index, uint8_t* chunk, ColumnHeights& column) {
+    generation::TerrainGenerator generator{};
+    generator.settings = key.terrain;
+    glm::ivec3 origin = glm::ivec3(grid.chunkOrigin(index));
+    glm::ivec3 extent = glm::ivec3(grid.chunkExtent(index));
+
+    switch (key.type) {
+        case GeneratorType::PERLIN_2D:
+            std::call_once(column.sampled, [&]() {
+                column.heights.resize((size_t)extent.x * extent.z);
+                generator.samplePerlin2DHeights(column.heights.data(), origin, extent, key.dimensions.y);
+            });
+            generator.fillPerlin2DRegion(chunk, column.heights.data(), origin, extent);
+            return;
+        case GeneratorType::PERLIN_3D:
+            generator.generatePerlin3DRegion(chunk, origin, extent);
+            return;
+    }
+    throw std::runtime_error("Unknown generator " + std::to_string((int)key.type) + "!");
+}
+
+// Holds an exclusive flock on a generation log while it lives, so processes
+// acquiring the same key take turns instead of interleaving their records
+class LogLock {
+public:
+    LogLock(const std::string& path) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open generation log!");
+        }
+        if (flock(fd, LOCK_EX) != 0) {
+            close(fd);
+            throw std::runtime_error("Failed to lock generation log!");
+        }
+    }
+    ~LogLock() { close(fd); }
+
+    LogLock(const LogLock&) = delete;
+    LogLock& operator=(const LogLock&) = delete;
+
+private:
+    int fd = -1;
+};
+
+static void serializePartialHeader(const GenerationKey& key, uint8_t* bytes) {
+    uint16_t version = GENERATION_PARTIAL_VERSION;
+    uint64_t key_hash = key.hash();
+    std::memset(bytes, 0, GENERATION_PARTIAL_HEADER_SIZE);
+    std::memcpy(bytes, GENERATION_PARTIAL_MAGIC, 4);
+    std::memcpy(bytes + 4, &version, 2);
+    std::memcpy(bytes + 6, &key.chunk_size, 2);
+    std::memcpy(bytes + 8, &key.dimensions.x, 4);
+    std::memcpy(bytes + 12, &key.dimensions.y, 4);
+    std::memcpy(bytes + 16, &key.dimensions.z, 4);
+    std::memcpy(bytes + 20, &key_hash, 8);
+}
+
+GenerationCache::GenerationCache(std::string directory_) :
+    directory{directory_}
+{}
+
+std::string GenerationCache::worldPath(const GenerationKey& key) const {
+    return directory + "/" + key.name() + ".ccst";
+}
+
+std::string GenerationCache::partialPath(const GenerationKey& key) const {
+    return directory + "/" + key.name() + ".ccsp";
+}
+
+bool GenerationCache::contains(const GenerationKey& key) const {
+    std::string path = worldPath(key);
+    if (!std::filesystem::exists(path)) {
+        return false;
+    }
+
+    try {
+        ChunkedStateReader reader{path};
+        return reader.getDimensions() == key.dimensions && reader.getHeader().chunk_size == key.chunk_size;
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
+
+std::string GenerationCache::acquire(const GenerationKey& key, ThreadPool& pool) {
+    std::string path = worldPath(key);
+    if (contains(key)) {
+        return path;
+    }
+
+    std::filesystem::create_directories(directory);
+    ChunkGrid grid{key.dimensions, key.chunk_size};
+
+    // Another process generating the same key holds the lock until it's done,
+    // after which the world is usually there. The log is only removed under
+    // the lock, so whoever holds it owns the file at partial_path.
+    std::string partial_path = partialPath(key);
+    LogLock log_lock{partial_path};
+    if (contains(key)) {
+        std::error_code error;
+        std::filesystem::remove(partial_path, error);
+        return path;
+    }
+
+    // Pick up the chunks logged by an earlier generation of the same key, a
+    // record cut short by a crash ends the log
+    std::vector<uint8_t> partial;
+    {
+        std::ifstream file(partial_path, std::ios::binary);
+        partial.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    uint8_t header[GENERATION_PARTIAL_HEADER_SIZE];
+    serializePartialHeader(key, header);
+    std::vector<ChunkEntry> entries(grid.chunkCount());
+    std::vector<bool> logged(grid.chunkCount(), false);
+    uint32_t logged_count = 0;
+
+    uint64_t valid_size = 0;
+    if (partial.size() >= GENERATION_PARTIAL_HEADER_SIZE && !std::memcmp(partial.data(), header, GENERATION_PARTIAL_HEADER_SIZE)) {
+        valid_size = GENERATION_PARTIAL_HEADER_SIZE;
+        while (valid_size + GENERATION_PARTIAL_RECORD_SIZE <= partial.size()) {
+            uint32_t index;
+            ChunkEntry entry;
+            std::memcpy(&index, partial.data() + valid_size, 4);
+            parseChunkEntry(partial.data() + valid_size + 4, entry);
+
+            uint64_t payload_offset = valid_size + GENERATION_PARTIAL_RECORD_SIZE;
+            if (index >= grid.chunkCount() || entry.compressed_size > partial.size() - payload_offset) {
+                break;
+            }
+            entry.offset = payload_offset;
+            if (!logged[index]) {
+                logged_count++;
+            }
+            entries[index] = entry;
+            logged[index] = true;
+            valid_size = payload_offset + entry.compressed_size;
+        }
+    }
+
+    if (valid_size == 0) {
+        std::ofstream file(partial_path, std::ios::binary | std::ios::trunc);
+        file.write((char*)header, GENERATION_PARTIAL_HEADER_SIZE);
+        if (!file) {
+            throw std::runtime_error("Failed to create generation log!");
+        }
+    } else {
+        std::filesystem::resize_file(partial_path, valid_size);
+        std::cout << "Resuming generation of " << key.name() << " with " << logged_count << " of " << grid.chunkCount() << " chunks" << std::endl;
+    }
+
+    std::ofstream log(partial_path, std::ios::binary | std::ios::app);
+    if (!log) {
+        throw std::runtime_error("Failed to open generation log!");
+    }
+    std::mutex log_mutex;
+
+    // Chunks are numbered z, y, x, so the chunks of a column are visited close together
+    std::vector<ColumnHeights> columns(grid.counts.x * grid.counts.z);
+    for (auto& column : columns) {
+        column.remaining = grid.counts.y;
+    }
+    auto columnOf = [&](uint32_t index) -> ColumnHeights& {
+        glm::uvec3 chunk = grid.chunkCoords(index);
+        return columns[chunk.z * grid.counts.x + chunk.x];
+    };
+    auto visitColumn = [&](ColumnHeights& column) {
+        if (column.remaining.fetch_sub(1) == 1) {
+            std::vector<int>().swap(column.heights);
+        }
+    };
+
+    // A unique name next to the world, so concurrent writers never share a
+    // temporary and the rename below stays on one filesystem
+    std::string temp_path = path + ".XXXXXX";
+    int temp_fd = mkstemp(temp_path.data());
+    if (temp_fd < 0) {
+        throw std::runtime_error("Failed to create temporary world file!");
+    }
+    // mkstemp creates it private to the user, the cached world is shared like any other file
+    fchmod(temp_fd, 0644);
+    close(temp_fd);
+
+    try {
+        writeChunkedState(temp_path, key.dimensions, key.chunk_size, ChunkCodecType::RLE,
+            [&](uint32_t index, uint8_t* scratch) -> const uint8_t* {
+                size_t volume = grid.chunkVolume(index);
+                ColumnHeights& column = columnOf(index);
+                if (logged[index]) {
+                    try {
+                        decodeChunk(entries[index], partial.data() + entries[index].offset, scratch, volume, ChunkChecksumType::XXH32);
+                        visitColumn(column);
+                        return scratch;
+                    } catch (const std::exception& e) {
+                        // Regenerated below, a later record for the chunk wins on the next load
+                    }
+                }
+
+                generateChunk(key, grid, index, scratch, column);
+                visitColumn(column);
+
+                std::vector<uint8_t> record(GENERATION_PARTIAL_RECORD_SIZE);
+                ChunkEntry entry = encodeChunk(scratch, volume, ChunkCodecType::RLE, record, ChunkChecksumType::XXH32);
+                std::memcpy(record.data(), &index, 4);
+                serializeChunkEntry(entry, record.data() + 4);
+
+                std::lock_guard<std::mutex> lock(log_mutex);
+                log.write((char*)record.data(), record.size());
+                // Reaches the file even if the process dies before the world is written
+                log.flush();
+                return scratch;
+            },
+            VoxelPacking::NIBBLE, pool);
+    } catch (...) {
+        std::filesystem::remove(temp_path);
+        throw;
+    }
+
+    log.close();
+    std::filesystem::rename(temp_path, path);
+    std::filesystem::remove(partial_path);
+    return path;
+}
+
+}
+}
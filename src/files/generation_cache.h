@@ -0,0 +1,57 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <string>
+#include <stdint.h>
+#include "glm/glm.hpp"
+#include "files/chunked_state.h"
+#include "math/generation/terrain_generator.h"
+#include "threading/thread_pool.h"
+
+#define GENERATION_PARTIAL_MAGIC "CCSP"
+#define GENERATION_PARTIAL_VERSION 1
+#define GENERATION_PARTIAL_HEADER_SIZE 32
+#define GENERATION_PARTIAL_RECORD_SIZE (4 + STATE_V2_ENTRY_SIZE)
+
+namespace cscd {
+namespace file {
+
+enum class GeneratorType : uint8_t {
+    PERLIN_2D = 0,
+    PERLIN_3D = 1
+};
+
+// Everything a generated world depends on
+struct GenerationKey {
+    GeneratorType type = GeneratorType::PERLIN_2D;
+    generation::TerrainSettings terrain{};
+    glm::uvec3 dimensions{0, 0, 0};
+    uint16_t chunk_size = STATE_DEFAULT_CHUNK_SIZE;
+
+    uint64_t hash() const;
+    // 16 hex digits of hash, used to name the cache files
+    std::string name() const;
+};
+
+// Keeps generated worlds on disk as CCS2 files named after their key, so a
+// world is only ever generated once. Chunks are generated one at a time and
+// logged to a partial file as they finish, so a generation that was cut short
+// picks up from the chunks it already has.
+class GenerationCache {
+public:
+    GenerationCache(std::string directory_);
+
+    bool contains(const GenerationKey& key) const;
+    // Path of the cached world for key, generating whatever isn't cached yet
+    std::string acquire(const GenerationKey& key, ThreadPool& pool = sharedThreadPool());
+
+private:
+    std::string worldPath(const GenerationKey& key) const;
+    std::string partialPath(const GenerationKey& key) const;
+
+    std::string directory;
+};
+
+}
+}
@@ -0,0 +1,156 @@
+#include <cstring>
+#include <stdexcept>
+#include "journal_file.h"
+
+namespace cscd {
+namespace file {
+
+JournalWriter::JournalWriter(std::string path, const JournalHeader& header_) :
+    file{path, std::ios::binary},
+    header{header_}
+{
+    if (!file) {
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    uint8_t bytes[JOURNAL_HEADER_SIZE];
+    std::memcpy(bytes, JOURNAL_MAGIC, 4);
+    std::memcpy(bytes + 4, &header.version, 2);
+    std::memcpy(bytes + 6, &header.chunk_size, 2);
+    std::memcpy(bytes + 8, &header.x_size, 4);
+    std::memcpy(bytes + 12, &header.y_size, 4);
+    std::memcpy(bytes + 16, &header.z_size, 4);
+    std::memcpy(bytes + 20, &header.base_seed, 4);
+    std::memcpy(bytes + 24, &header.hash_interval, 4);
+    file.write((char*)bytes, JOURNAL_HEADER_SIZE);
+}
+
+void JournalWriter::writeFrame(const JournalFrame& frame) {
+    // Only store the camera when it actually moved
+    uint8_t flags = 0;
+    if (frame.has_camera && (!has_camera || frame.camera_position != camera_position || frame.camera_direction != camera_direction)) {
+        flags |= JOURNAL_FRAME_HAS_CAMERA;
+        has_camera = true;
+        camera_position = frame.camera_position;
+        camera_direction = frame.camera_direction;
+    }
+
+    uint8_t type = JOURNAL_RECORD_FRAME;
+    uint32_t edit_count = frame.edits.size();
+    file.write((char*)&type, 1);
+    file.write((char*)&frame.seed, 4);
+    file.write((char*)&frame.frame_time, 4);
+    file.write((char*)&flags, 1);
+    if (flags & JOURNAL_FRAME_HAS_CAMERA) {
+        file.write((char*)&camera_position, sizeof(float) * 3);
+        file.write((char*)&camera_direction, sizeof(float) * 3);
+    }
+    file.write((char*)&edit_count, 4);
+    for (auto& edit : frame.edits) {
+        file.write((char*)&edit.location, sizeof(int32_t) * 3);
+        file.write((char*)&edit.value, 1);
+    }
+
+    if (!file) {
+        throw std::runtime_error("Failed to write journal frame!");
+    }
+}
+
+void JournalWriter::writeChunkHashes(uint32_t frame, const std::vector<uint32_t>& hashes) {
+    uint8_t type = JOURNAL_RECORD_HASHES;
+    uint32_t count = hashes.size();
+    file.write((char*)&type, 1);
+    file.write((char*)&frame, 4);
+    file.write((char*)&count, 4);
+    file.write((char*)hashes.data(), sizeof(uint32_t) * count);
+
+    if (!file) {
+        throw std::runtime_error("Failed to write journal hashes!");
+    }
+}
+
+Journal readJournal(std::string path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    uint8_t bytes[JOURNAL_HEADER_SIZE];
+    file.read((char*)bytes, JOURNAL_HEADER_SIZE);
+    if (!file) {
+        throw std::runtime_error("Truncated journal header!");
+    } else if (std::memcmp(bytes, JOURNAL_MAGIC, 4)) {
+        throw std::runtime_error("Invalid file magic!");
+    }
+
+    Journal journal{};
+    JournalHeader& header = journal.header;
+    std::memcpy(&header.version, bytes + 4, 2);
+    std::memcpy(&header.chunk_size, bytes + 6, 2);
+    std::memcpy(&header.x_size, bytes + 8, 4);
+    std::memcpy(&header.y_size, bytes + 12, 4);
+    std::memcpy(&header.z_size, bytes + 16, 4);
+    std::memcpy(&header.base_seed, bytes + 20, 4);
+    std::memcpy(&header.hash_interval, bytes + 24, 4);
+
+    if (header.version != JOURNAL_VERSION) {
+        throw std::runtime_error("Unsupported journal version!");
+    }
+
+    // A run that was killed can leave a partial record at the end, everything before it is kept
+    uint8_t type;
+    while (file.read((char*)&type, 1)) {
+        if (type == JOURNAL_RECORD_FRAME) {
+            JournalFrame frame{};
+            uint8_t flags = 0;
+            uint32_t edit_count = 0;
+            file.read((char*)&frame.seed, 4);
+            file.read((char*)&frame.frame_time, 4);
+            file.read((char*)&flags, 1);
+
+            // Frames without a camera reuse the last one that was stored
+            if (flags & JOURNAL_FRAME_HAS_CAMERA) {
+                file.read((char*)&frame.camera_position, sizeof(float) * 3);
+                file.read((char*)&frame.camera_direction, sizeof(float) * 3);
+                frame.has_camera = true;
+            } else if (!journal.frames.empty()) {
+                const JournalFrame& prev = journal.frames.back();
+                frame.has_camera = prev.has_camera;
+                frame.camera_position = prev.camera_position;
+                frame.camera_direction = prev.camera_direction;
+            }
+
+            file.read((char*)&edit_count, 4);
+            frame.edits.resize(edit_count);
+            for (auto& edit : frame.edits) {
+                file.read((char*)&edit.location, sizeof(int32_t) * 3);
+                file.read((char*)&edit.value, 1);
+            }
+
+            if (!file) {
+                break;
+            }
+            journal.frames.push_back(std::move(frame));
+        } else if (type == JOURNAL_RECORD_HASHES) {
+            uint32_t frame = 0;
+            uint32_t count = 0;
+            file.read((char*)&frame, 4);
+            file.read((char*)&count, 4);
+
+            std::vector<uint32_t> hashes(count);
+            file.read((char*)hashes.data(), sizeof(uint32_t) * count);
+
+            if (!file) {
+                break;
+            }
+            journal.chunk_hashes[frame] = std::move(hashes);
+        } else {
+            throw std::runtime_error("Unknown journal record type " + std::to_string(type) + "!");
+        }
+    }
+
+    return journal;
+}
+
+}
+}
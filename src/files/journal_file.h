@@ -0,0 +1,84 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <map>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <stdint.h>
+#include "glm/glm.hpp"
+
+#define JOURNAL_MAGIC "CCSJ"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 28
+
+#define JOURNAL_RECORD_FRAME 1
+#define JOURNAL_RECORD_HASHES 2
+
+#define JOURNAL_FRAME_HAS_CAMERA 1
+
+namespace cscd {
+namespace file {
+
+struct JournalHeader {
+    uint16_t version = JOURNAL_VERSION;
+    uint16_t chunk_size = 0;
+    uint32_t x_size = 0;
+    uint32_t y_size = 0;
+    uint32_t z_size = 0;
+    uint32_t base_seed = 0;
+    uint32_t hash_interval = 0;
+};
+
+struct JournalEdit {
+    glm::ivec3 location;
+    uint8_t value;
+};
+
+// Everything that feeds into one simulated frame. The camera is only stored
+// when it moved, has_camera is false on frames that reuse the previous one.
+struct JournalFrame {
+    uint32_t seed = 0;
+    float frame_time = 0.0f;
+    bool has_camera = false;
+    glm::vec3 camera_position{0.0f};
+    glm::vec3 camera_direction{0.0f};
+    std::vector<JournalEdit> edits;
+};
+
+// A whole journal, loaded up front for replay. chunk_hashes maps a frame
+// number to the per-chunk hashes of the world after that frame's physics.
+struct Journal {
+    JournalHeader header;
+    std::vector<JournalFrame> frames;
+    std::map<uint32_t, std::vector<uint32_t>> chunk_hashes;
+};
+
+// Streams records to disk as a run progresses, so a crashed run still leaves
+// a usable journal behind.
+class JournalWriter {
+public:
+    JournalWriter(std::string path, const JournalHeader& header_);
+
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+
+    const JournalHeader& getHeader() const { return header; }
+
+    void writeFrame(const JournalFrame& frame);
+    void writeChunkHashes(uint32_t frame, const std::vector<uint32_t>& hashes);
+    void flush() { file.flush(); }
+
+private:
+    std::ofstream file;
+    JournalHeader header;
+    bool has_camera = false;
+    glm::vec3 camera_position{0.0f};
+    glm::vec3 camera_direction{0.0f};
+};
+
+Journal readJournal(std::string path);
+
+}
+}
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapped_state.h"
+#include "state_file.h"
+
+namespace cscd {
+namespace file {
+
+MappedState::MappedState(std::string path) {
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < 4) {
+        close(fd);
+        throw std::runtime_error("File contains no data!");
+    }
+    mapping_size = file_stat.st_size;
+
+    void* address = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Failed to map file!");
+    }
+    mapping = static_cast<const uint8_t*>(address);
+
+    try {
+        if (!std::memcmp(mapping, STATE_MAGIC, 4)) {
+            parseV1();
+        } else if (!std::memcmp(mapping, STATE_MAGIC_V2, 4)) {
+            parseV2();
+        } else {
+            throw std::runtime_error("Invalid file magic!");
+        }
+    } catch (...) {
+        munmap(const_cast<uint8_t*>(mapping), mapping_size);
+        close(fd);
+        throw;
+    }
+}
+
+MappedState::~MappedState() {
+    munmap(const_cast<uint8_t*>(mapping), mapping_size);
+    close(fd);
+}
+
+void MappedState::parseV1() {
+    const size_t header_size = 10;
+    if (mapping_size < header_size) {
+        throw std::runtime_error("Truncated state header!");
+    }
+
+    uint16_t sizes[3];
+    std::memcpy(sizes, mapping + 4, 6);
+    dimensions = glm::uvec3{sizes[0], sizes[1], sizes[2]};
+
+    if (getSize() == 0) {
+        throw std::runtime_error("File contains no data!");
+    } else if (mapping_size - header_size < getSize()) {
+        throw std::runtime_error("Truncated voxel data!");
+    }
+
+    voxels = mapping + header_size;
+    madvise(const_cast<uint8_t*>(mapping), mapping_size, MADV_SEQUENTIAL);
+}
+
+void MappedState::parseV2() {
+    if (mapping_size < STATE_V2_HEADER_SIZE) {
+        throw std::runtime_error("Truncated state header!");
+    }
+
+    chunked = true;
+    parseChunkedHeader(mapping, header);
+    dimensions = glm::uvec3{header.x_size, header.y_size, header.z_size};
+    grid = ChunkGrid{dimensions, header.chunk_size};
+
+    if (grid.chunkCount() == 0) {
+        throw std::runtime_error("File contains no data!");
+    } else if (grid.chunkCount() != header.chunk_count) {
+        throw std::runtime_error("Chunk directory doesn't match size values!");
+    } else if (mapping_size < STATE_V2_HEADER_SIZE + (uint64_t)header.chunk_count * STATE_V2_ENTRY_SIZE) {
+        throw std::runtime_error("Truncated chunk directory!");
+    }
+
+    entries.resize(header.chunk_count);
+    for (uint32_t i = 0; i < header.chunk_count; i++) {
+        parseChunkEntry(mapping + STATE_V2_HEADER_SIZE + (size_t)i * STATE_V2_ENTRY_SIZE, entries[i]);
+        if (entries[i].offset > mapping_size || entries[i].compressed_size > mapping_size - entries[i].offset) {
+            throw std::runtime_error("Chunk " + std::to_string(i) + " lies outside the file!");
+        }
+    }
+
+    // Every entry was checked to lie inside the mapping above
+    shared = SharedPayloadCache{entries, [](const ChunkEntry&) { return true; }};
+
+    // Payloads are laid out in chunk order (deduplicated chunks aside), so the decode below walks the file front to back
+    madvise(const_cast<uint8_t*>(mapping), mapping_size, MADV_SEQUENTIAL);
+}
+
+void MappedState::decodeInto(uint8_t* world) {
+    decodeLayers(0, dimensions.z, world);
+}
+
+void MappedState::decodeLayers(uint32_t z_begin, uint32_t z_count, uint8_t* layers) {
+    if ((uint64_t)z_begin + z_count > dimensions.z) {
+        throw std::runtime_error("Layer range outside of the world!");
+    }
+
+    if (!chunked) {
+        std::memcpy(layers, voxels + z_begin * getLayerSize(), z_count * getLayerSize());
+        return;
+    }
+
+    uint32_t z_end = z_begin + z_count;
+    uint32_t chunk_layers = grid.counts.x * grid.counts.y;
+    uint32_t first = (z_begin / grid.chunk_size) * chunk_layers;
+    uint32_t last = ((z_end + grid.chunk_size - 1) / grid.chunk_size) * chunk_layers;
+
+    std::vector<uint8_t> chunk((size_t)grid.chunk_size * grid.chunk_size * grid.chunk_size);
+    std::vector<uint8_t> packed;
+    VoxelPacking packing = header.getPacking();
+    ChunkChecksumType checksum = header.getChecksumType();
+    for (uint32_t i = first; i < last; i++) {
+        const ChunkEntry& entry = entries[i];
+        const uint8_t* payload = mapping + entry.offset;
+        size_t volume = grid.chunkVolume(i);
+
+        if (shared.isShared(i)) {
+            uint32_t rank = shared.rank(entry.offset);
+            SharedPayload& cached = shared[rank];
+            if (!sharesPayload(entry, entries[cached.owner])) {
+                throw std::runtime_error("Chunk " + std::to_string(i) + " shares a payload with chunk " + std::to_string(cached.owner) + " but doesn't match it!");
+            }
+            if (cached.voxels.empty() && shared.keepsDecoded(rank)) {
+                const ChunkEntry& owner = entries[cached.owner];
+                cached.voxels.resize(grid.chunkVolume(cached.owner));
+                decodeChunkVoxels(owner, payload, packing, cached.voxels.data(), cached.voxels.size(), packed, checksum);
+            }
+            if (cached.voxels.size() == volume) {
+                grid.scatterLayers(cached.voxels.data(), i, z_begin, z_end, layers);
+                continue;
+            }
+        }
+
+        if (chunkChecksum(payload, entry.compressed_size, checksum) != entry.checksum) {
+            throw std::runtime_error("Chunk " + std::to_string(i) + " checksum mismatch!");
+        }
+
+        // Raw byte chunks are scattered straight out of the mapping
+        if (packing == VoxelPacking::BYTE && entry.codec == ChunkCodecType::RAW && entry.compressed_size == volume) {
+            grid.scatterLayers(payload, i, z_begin, z_end, layers);
+        } else if (packing == VoxelPacking::BYTE) {
+            getChunkCodec(entry.codec).decode(payload, entry.compressed_size, chunk.data(), volume);
+            grid.scatterLayers(chunk.data(), i, z_begin, z_end, layers);
+        } else {
+            packed.resize(packedSize(volume, packing));
+            getChunkCodec(entry.codec).decode(payload, entry.compressed_size, packed.data(), packed.size());
+            unpackNibbles(packed.data(), volume, chunk.data());
+            grid.scatterLayers(chunk.data(), i, z_begin, z_end, layers);
+        }
+    }
+}
+
+void MappedState::layerByteRange(uint32_t z_begin, uint32_t z_count, uint64_t& begin, uint64_t& end) {
+    if (!chunked) {
+        begin = (voxels - mapping) + z_begin * getLayerSize();
+        end = begin + z_count * getLayerSize();
+        return;
+    }
+
+    // Payloads are written in chunk order, so a run of chunk layers is one contiguous range
+    uint32_t chunk_layers = grid.counts.x * grid.counts.y;
+    uint32_t first = (z_begin / grid.chunk_size) * chunk_layers;
+    uint32_t last = std::min<uint32_t>(((z_begin + z_count + grid.chunk_size - 1) / grid.chunk_size) * chunk_layers, entries.size());
+    begin = mapping_size;
+    end = 0;
+    for (uint32_t i = first; i < last; i++) {
+        begin = std::min(begin, entries[i].offset);
+        end = std::max(end, entries[i].offset + entries[i].compressed_size);
+    }
+}
+
+void MappedState::prefetchLayers(uint32_t z_begin, uint32_t z_count) {
+    if (z_begin >= dimensions.z) {
+        return;
+    }
+    z_count = std::min(z_count, dimensions.z - z_begin);
+
+    uint64_t begin, end;
+    layerByteRange(z_begin, z_count, begin, end);
+    if (begin >= end) {
+        return;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    begin -= begin % page_size;
+    madvise(const_cast<uint8_t*>(mapping) + begin, end - begin, MADV_WILLNEED);
+}
+
+}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "glm/glm.hpp"
+#include "files/chunked_state.h"
+#include "files/world_source.h"
+
+namespace cscd {
+namespace file {
+
+// Read-only mmap of a CCST (v1) or CCS2 (v2) file. Voxels are decoded straight
+// from the mapping into a caller provided buffer (e.g. a mapped staging
+// allocation), so no host side copy of the world is ever made.
+class MappedState : public WorldSource {
+public:
+    MappedState(std::string path);
+    ~MappedState();
+
+    MappedState(const MappedState&) = delete;
+    MappedState& operator=(const MappedState&) = delete;
+
+    glm::uvec3 getDimensions() const override { return dimensions; }
+    bool isChunked() const { return chunked; }
+    // Whole chunks, so a chunk is never decoded twice
+    uint32_t getPreferredLayerBatch() const override { return chunked ? header.chunk_size : 1; }
+
+    void decodeInto(uint8_t* world);
+    void decodeLayers(uint32_t z_begin, uint32_t z_count, uint8_t* layers) override;
+    // Asks the kernel to start reading the given layers in the background
+    void prefetchLayers(uint32_t z_begin, uint32_t z_count) override;
+
+private:
+    void parseV1();
+    void parseV2();
+    void layerByteRange(uint32_t z_begin, uint32_t z_count, uint64_t& begin, uint64_t& end);
+
+    int fd = -1;
+    const uint8_t* mapping = nullptr;
+    size_t mapping_size = 0;
+
+    bool chunked = false;
+    glm::uvec3 dimensions{0, 0, 0};
+    const uint8_t* voxels = nullptr;
+    ChunkedStateHeader header{};
+    ChunkGrid grid{glm::uvec3{0, 0, 0}, STATE_DEFAULT_CHUNK_SIZE};
+    std::vector<ChunkEntry> entries;
+    // Kept across decodeLayers calls, a shared payload is decoded once per load
+    SharedPayloadCache shared;
+};
+
+}
+}
@@ -0,0 +1,133 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "snapshot_file.h"
+
+namespace cscd {
+namespace file {
+
+void writeSnapshotDelta(std::string path, const ChunkGrid& grid, uint32_t sequence,
+                        const std::vector<uint32_t>& chunk_indices, const ChunkSource& source,
+                        ChunkCodecType codec) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    SnapshotDeltaHeader header{};
+    header.chunk_size = grid.chunk_size;
+    header.x_size = grid.dimensions.x;
+    header.y_size = grid.dimensions.y;
+    header.z_size = grid.dimensions.z;
+    header.sequence = sequence;
+    header.entry_count = chunk_indices.size();
+
+    std::vector<ChunkEntry> entries(header.entry_count);
+    uint64_t offset = SNAPSHOT_DELTA_HEADER_SIZE + (uint64_t)header.entry_count * SNAPSHOT_DELTA_ENTRY_SIZE;
+    file.seekp(offset);
+
+    // Kept to compare against, deltas only hold the chunks that changed
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> written;
+    std::vector<uint8_t> scratch((size_t)grid.chunk_size * grid.chunk_size * grid.chunk_size);
+    uint64_t payloads_offset = offset;
+    PayloadDeduplicator deduplicator{[&](uint64_t payload_offset, uint8_t* data, size_t size) {
+        std::memcpy(data, written.data() + (payload_offset - payloads_offset), size);
+    }};
+    for (uint32_t i = 0; i < header.entry_count; i++) {
+        if (chunk_indices[i] >= grid.chunkCount()) {
+            throw std::runtime_error("Chunk index out of range!");
+        }
+
+        payload.clear();
+        const uint8_t* chunk = source(chunk_indices[i], scratch.data());
+        entries[i] = encodeChunk(chunk, grid.chunkVolume(chunk_indices[i]), codec, payload);
+        if (deduplicator.place(entries[i], chunkContentHash(payload.data(), payload.size()), payload.data(), offset)) {
+            file.write(reinterpret_cast<char*>(payload.data()), payload.size());
+            written.insert(written.end(), payload.begin(), payload.end());
+            offset += payload.size();
+        }
+    }
+
+    file.seekp(0);
+    file.write(SNAPSHOT_DELTA_MAGIC, 4);
+    file.write((char*)&header.version, 2);
+    file.write((char*)&header.chunk_size, 2);
+    file.write((char*)&header.x_size, 4);
+    file.write((char*)&header.y_size, 4);
+    file.write((char*)&header.z_size, 4);
+    file.write((char*)&header.sequence, 4);
+    file.write((char*)&header.entry_count, 4);
+    for (uint32_t i = 0; i < header.entry_count; i++) {
+        file.write((char*)&chunk_indices[i], 4);
+        writeChunkEntry(file, entries[i]);
+    }
+
+    if (!file) {
+        throw std::runtime_error("Failed to write snapshot delta!");
+    }
+    file.close();
+}
+
+uint32_t applySnapshotDelta(std::string path, const ChunkGrid& grid, uint8_t* world) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open file!");
+    }
+
+    char magic[5];
+    file.read(magic, 4);
+    magic[4] = '\0';
+
+    if (strcmp(magic, SNAPSHOT_DELTA_MAGIC)) {
+        throw std::runtime_error("Invalid file magic!");
+    }
+
+    SnapshotDeltaHeader header{};
+    file.read((char*)&header.version, 2);
+    file.read((char*)&header.chunk_size, 2);
+    file.read((char*)&header.x_size, 4);
+    file.read((char*)&header.y_size, 4);
+    file.read((char*)&header.z_size, 4);
+    file.read((char*)&header.sequence, 4);
+    file.read((char*)&header.entry_count, 4);
+
+    if (!file) {
+        throw std::runtime_error("Truncated snapshot delta header!");
+    } else if (header.version != SNAPSHOT_DELTA_VERSION) {
+        throw std::runtime_error("Unsupported snapshot delta version!");
+    } else if (header.chunk_size != grid.chunk_size || header.x_size != grid.dimensions.x ||
+               header.y_size != grid.dimensions.y || header.z_size != grid.dimensions.z) {
+        throw std::runtime_error("Snapshot delta doesn't match the world it is applied to!");
+    }
+
+    std::vector<uint32_t> chunk_indices(header.entry_count);
+    std::vector<ChunkEntry> entries(header.entry_count);
+    for (uint32_t i = 0; i < header.entry_count; i++) {
+        file.read((char*)&chunk_indices[i], 4);
+        readChunkEntry(file, entries[i]);
+    }
+
+    std::vector<uint8_t> chunk((size_t)grid.chunk_size * grid.chunk_size * grid.chunk_size);
+    std::vector<uint8_t> payload;
+    for (uint32_t i = 0; i < header.entry_count; i++) {
+        if (chunk_indices[i] >= grid.chunkCount()) {
+            throw std::runtime_error("Chunk index out of range!");
+        }
+
+        payload.resize(entries[i].compressed_size);
+        file.seekg(entries[i].offset);
+        file.read(reinterpret_cast<char*>(payload.data()), payload.size());
+        if (!file) {
+            throw std::runtime_error("Truncated chunk payload!");
+        }
+
+        decodeChunk(entries[i], payload.data(), chunk.data(), grid.chunkVolume(chunk_indices[i]));
+        grid.scatter(chunk.data(), chunk_indices[i], world);
+    }
+
+    return header.sequence;
+}
+
+}
+}
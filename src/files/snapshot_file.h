@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "files/chunked_state.h"
+
+#define SNAPSHOT_DELTA_MAGIC "CCSD"
+#define SNAPSHOT_DELTA_VERSION 1
+#define SNAPSHOT_DELTA_HEADER_SIZE 28
+#define SNAPSHOT_DELTA_ENTRY_SIZE (4 + STATE_V2_ENTRY_SIZE)
+
+namespace cscd {
+namespace file {
+
+// A delta holds only the chunks that changed since the previous snapshot. A
+// world is restored by loading the base CCS2 file and applying its deltas in
+// sequence order.
+struct SnapshotDeltaHeader {
+    uint16_t version = SNAPSHOT_DELTA_VERSION;
+    uint16_t chunk_size = STATE_DEFAULT_CHUNK_SIZE;
+    uint32_t x_size = 0;
+    uint32_t y_size = 0;
+    uint32_t z_size = 0;
+    uint32_t sequence = 0;
+    uint32_t entry_count = 0;
+};
+
+// source is asked for each of chunk_indices in turn, on the calling thread
+void writeSnapshotDelta(std::string path, const ChunkGrid& grid, uint32_t sequence,
+                        const std::vector<uint32_t>& chunk_indices, const ChunkSource& source,
+                        ChunkCodecType codec = ChunkCodecType::RLE);
+// Returns the delta's sequence number
+uint32_t applySnapshotDelta(std::string path, const ChunkGrid& grid, uint8_t* world);
+
+}
+}
@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <fstream>
 #include <iterator>
 #include <stdexcept>
 #include "state_file.h"
+#include "snapshot_file.h"
 
 cscd::file::State::State(std::string path) {
     std::ifstream file(path, std::ios::binary);
@@ -14,16 +16,25 @@ cscd::file::State::State(std::string path) {
     file.read(magic, 4);
     magic[4] = '\0';
 
-    if (strcmp(magic, STATE_MAGIC)) {
+    if (!strcmp(magic, STATE_MAGIC)) {
+        readV1(file);
+    } else if (!strcmp(magic, STATE_MAGIC_V2)) {
+        file.close();
+        readV2(path);
+    } else {
         throw std::runtime_error("Invalid file magic!");
     }
+}
 
-    file.read((char*)&x_size, 2);
-    file.read((char*)&y_size, 2);
-    file.read((char*)&z_size, 2);
-    int size = x_size * y_size * z_size;
+void cscd::file::State::readV1(std::ifstream& file) {
+    uint16_t sizes[3];
+    file.read((char*)sizes, 6);
+    x_size = sizes[0];
+    y_size = sizes[1];
+    z_size = sizes[2];
+    uint64_t size = (uint64_t)x_size * y_size * z_size;
 
-    if (size <= 0) {
+    if (size == 0) {
         throw std::runtime_error("File contains no data!");
     }
 
@@ -33,52 +44,207 @@ cscd::file::State::State(std::string path) {
     file.close();
 }
 
-void cscd::file::State::writeToFile(std::string path) {
-    int size = x_size * y_size * z_size;
+void cscd::file::State::readV2(std::string path) {
+    ChunkedStateReader reader{path};
+    glm::uvec3 dimensions = reader.getDimensions();
+    if (reader.getHeader().getPacking() == VoxelPacking::BYTE) {
+        setSize(dimensions.x, dimensions.y, dimensions.z);
+        reader.readAll(data.data());
+        return;
+    }
+
+    // Decoded a chunk layer at a time and packed as it goes, so the world is
+    // never held a byte per voxel. Packed chunks only hold values that fit.
+    packing = VoxelPacking::NIBBLE;
+    setSize(dimensions.x, dimensions.y, dimensions.z);
+    size_t layer_size = (size_t)x_size * y_size;
+    uint32_t slab_layers = std::min<uint32_t>(reader.getHeader().chunk_size, z_size);
+    std::vector<uint8_t> slab(layer_size * slab_layers);
+    for (uint32_t z = 0; z < z_size; z += slab_layers) {
+        uint32_t z_count = std::min(slab_layers, z_size - z);
+        reader.readLayers(z, z_count, slab.data());
+        packNibblesAt(slab.data(), layer_size * z_count, data.data(), layer_size * z);
+    }
+}
+
+void cscd::file::State::writeToFile(std::string path, StateFormat format) {
+    if (format == StateFormat::V1) {
+        writeV1(path);
+        return;
+    }
+
+    uint64_t size = (uint64_t)x_size * y_size * z_size;
+    if (size == 0) {
+        throw std::runtime_error("State struct contains no data!");
+    } else if (packedSize(size, packing) != data.size()) {
+        throw std::runtime_error("Provided data doesn't match size values!");
+    }
+
+    if (!isPacked()) {
+        writeChunkedState(path, glm::uvec3{x_size, y_size, z_size}, data.data());
+        return;
+    }
+
+    // Chunks are unpacked a row at a time, so the world is never expanded as a whole
+    ChunkGrid grid{glm::uvec3{x_size, y_size, z_size}, STATE_DEFAULT_CHUNK_SIZE};
+    writeChunkedState(path, grid.dimensions, grid.chunk_size, ChunkCodecType::RLE, [&](uint32_t index, uint8_t* scratch) {
+        glm::uvec3 origin = grid.chunkOrigin(index);
+        glm::uvec3 extent = grid.chunkExtent(index);
+        uint8_t* row = scratch;
+        for (uint32_t z = 0; z < extent.z; z++) {
+            for (uint32_t y = 0; y < extent.y; y++) {
+                size_t start = (size_t)(origin.z + z) * y_size * x_size + (size_t)(origin.y + y) * x_size + origin.x;
+                if (start % 2 == 0) {
+                    unpackNibbles(data.data() + start / 2, extent.x, row);
+                } else {
+                    for (uint32_t x = 0; x < extent.x; x++) {
+                        row[x] = readNibble(data.data(), start + x);
+                    }
+                }
+                row += extent.x;
+            }
+        }
+        return (const uint8_t*)scratch;
+    }, VoxelPacking::NIBBLE);
+}
+
+uint32_t cscd::file::State::applySnapshotDelta(std::string path, uint16_t chunk_size) {
+    bool was_packed = isPacked();
+    unpack();
+
+    ChunkGrid grid{glm::uvec3{x_size, y_size, z_size}, chunk_size};
+    uint32_t sequence = file::applySnapshotDelta(path, grid, data.data());
+
+    if (was_packed) {
+        pack();
+    }
+    return sequence;
+}
+
+void cscd::file::State::fillPerlin() {
+    if (!isPacked()) {
+        generator.generatePerlin2D(data.data(), x_size, y_size, z_size);
+        return;
+    }
+
+    // Generated a slab of layers at a time and packed as it goes, each layer
+    // on its own worker, so the world is never held a byte per voxel
+    ThreadPool& pool = sharedThreadPool();
+    size_t layer_size = (size_t)x_size * y_size;
+    uint32_t slab_layers = std::min<uint32_t>(pool.getThreadCount() * 4, z_size);
+    std::vector<uint8_t> slab(layer_size * slab_layers);
+    for (uint32_t z = 0; z < z_size; z += slab_layers) {
+        uint32_t z_count = std::min(slab_layers, z_size - z);
+        pool.parallelFor(z_count, [&](uint32_t layer, unsigned worker) {
+            cscd::generation::TerrainGenerator layer_generator{};
+            layer_generator.settings = generator.settings;
+            layer_generator.generatePerlin2DRegion(slab.data() + layer * layer_size, glm::ivec3(0, 0, z + layer),
+                                                   glm::ivec3(x_size, y_size, 1), y_size);
+        });
+
+        if (!fitsNibbles(slab.data(), layer_size * z_count)) {
+            throw std::runtime_error("Generated voxels don't fit in 4 bits!");
+        }
+        packNibblesAt(slab.data(), layer_size * z_count, data.data(), layer_size * z);
+    }
+}
+
+void cscd::file::State::pack() {
+    if (isPacked()) {
+        return;
+    }
+
+    size_t size = (size_t)x_size * y_size * z_size;
+    if (!fitsNibbles(data.data(), size)) {
+        throw std::runtime_error("State has voxels that don't fit in 4 bits!");
+    }
+
+    std::vector<uint8_t> packed(packedSize(size, VoxelPacking::NIBBLE));
+    packNibbles(data.data(), size, packed.data());
+    data = std::move(packed);
+    packing = VoxelPacking::NIBBLE;
+}
+
+void cscd::file::State::unpack() {
+    if (!isPacked()) {
+        return;
+    }
+
+    size_t size = (size_t)x_size * y_size * z_size;
+    std::vector<uint8_t> voxels(size);
+    unpackNibbles(data.data(), size, voxels.data());
+    data = std::move(voxels);
+    packing = VoxelPacking::BYTE;
+}
+
+void cscd::file::State::writeV1(std::string path) {
+    uint64_t size = (uint64_t)x_size * y_size * z_size;
+
+    // v1 stores its sizes in 16 bits
+    if (x_size > UINT16_MAX || y_size > UINT16_MAX || z_size > UINT16_MAX) {
+        throw std::runtime_error("State is too large for a v1 file!");
+    }
     std::ofstream file(path, std::ios::binary);
 
-    if (size <= 0) {
+    if (size == 0) {
         throw std::runtime_error("State struct contains no data!");
-    } else if (size != data.size()) {
+    } else if (packedSize(size, packing) != data.size()) {
         throw std::runtime_error("Provided data doesn't match size values!");
     } else if (!file) {
         throw std::runtime_error("Failed to open file!");
     }
 
+    uint16_t sizes[3] = {(uint16_t)x_size, (uint16_t)y_size, (uint16_t)z_size};
     file.write(STATE_MAGIC, 4);
-    file.write((char*)&x_size, 2);
-    file.write((char*)&y_size, 2);
-    file.write((char*)&z_size, 2);
-    file.write(reinterpret_cast<char*>(data.data()), size);
+    file.write((char*)sizes, 6);
+
+    // v1 has no packed form
+    if (isPacked()) {
+        std::vector<uint8_t> voxels(size);
+        unpackNibbles(data.data(), size, voxels.data());
+        file.write(reinterpret_cast<char*>(voxels.data()), size);
+    } else {
+        file.write(reinterpret_cast<char*>(data.data()), size);
+    }
 
     file.close();
 }
 
-void cscd::file::State::setSize(uint16_t x_size_, uint16_t y_size_, uint16_t z_size_) {
+void cscd::file::State::setSize(uint32_t x_size_, uint32_t y_size_, uint32_t z_size_) {
     x_size = x_size_;
     y_size = y_size_;
     z_size = z_size_;
-    data.resize(x_size * y_size * z_size);
+    data.resize(packedSize((uint64_t)x_size * y_size * z_size, packing));
 }
 
-int cscd::file::State::getSize() {
-    int size = x_size * y_size * z_size;
-    if (size != data.size()) {
+uint64_t cscd::file::State::getSize() {
+    uint64_t size = (uint64_t)x_size * y_size * z_size;
+    if (packedSize(size, packing) != data.size()) {
         throw std::runtime_error("Data doesn't match size values!");
     }
     return size;
 }
 
 glm::ivec3 cscd::file::State::getDimensions() {
-    return glm::ivec3{x_size, y_size, z_size};
+    return glm::ivec3(x_size, y_size, z_size);
 }
 
-uint8_t cscd::file::State::read(int x, int y, int z) {
-    int index = z * y_size * x_size + y * x_size + x;
+uint8_t cscd::file::State::read(uint32_t x, uint32_t y, uint32_t z) {
+    size_t index = (size_t)z * y_size * x_size + (size_t)y * x_size + x;
+    if (isPacked()) {
+        return readNibble(data.data(), index);
+    }
     return data[index];
 }
 
-void cscd::file::State::write(int x, int y, int z, uint8_t byte) {
-    int index = z * y_size * x_size + y * x_size + x;
+void cscd::file::State::write(uint32_t x, uint32_t y, uint32_t z, uint8_t byte) {
+    size_t index = (size_t)z * y_size * x_size + (size_t)y * x_size + x;
+    if (isPacked()) {
+        if (byte > NIBBLE_MAX_VALUE) {
+            throw std::runtime_error("Voxel value doesn't fit in a packed state!");
+        }
+        writeNibble(data.data(), index, byte);
+        return;
+    }
     data[index] = byte;
 }
\ No newline at end of file
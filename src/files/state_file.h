@@ -4,53 +4,76 @@
 
 #include <vector>
 #include <string>
+#include <fstream>
 #include <cstring>
 #include <stdint.h>
 #include "glm/glm.hpp"
 #include "glm/gtc/constants.hpp"
 #include "math/generation/terrain_generator.h"
+#include "files/chunked_state.h"
+#include "files/voxel_packing.h"
 
 #define STATE_MAGIC "CCST"
 
 namespace cscd {
 namespace file {
 
+enum class StateFormat {
+    V1,     // Raw voxel bytes after the header
+    V2      // Chunk directory + per chunk compressed payloads
+};
+
+// data holds one byte per voxel, or two voxels per byte once packed. Files
+// written from a packed state are packed on disk too.
 struct State {
-    uint16_t x_size = 0;
-    uint16_t y_size = 0;
-    uint16_t z_size = 0;
+    uint32_t x_size = 0;
+    uint32_t y_size = 0;
+    uint32_t z_size = 0;
+    VoxelPacking packing = VoxelPacking::BYTE;
     std::vector<uint8_t> data;
 
     cscd::generation::TerrainGenerator generator{};
 
     State() = delete;
-    State(uint16_t x_size_, uint16_t y_size_, uint16_t z_size_, uint8_t* data_) :
+    State(uint32_t x_size_, uint32_t y_size_, uint32_t z_size_, uint8_t* data_) :
         x_size{x_size_},
         y_size{y_size_},
         z_size{z_size_}
     {
-        int size = x_size_ * y_size_ * z_size_;
+        uint64_t size = (uint64_t)x_size_ * y_size_ * z_size_;
         data.resize(size);
         std::memcpy(data.data(), data_, size);
     }
-    State(uint16_t x_size_, uint16_t y_size_, uint16_t z_size_) :
+    State(uint32_t x_size_, uint32_t y_size_, uint32_t z_size_) :
         x_size{x_size_},
         y_size{y_size_},
         z_size{z_size_}
     {
-        int size = x_size_ * y_size_ * z_size_;
+        uint64_t size = (uint64_t)x_size_ * y_size_ * z_size_;
         data.resize(size);
     }
     State(std::string path);
 
-    void setSize(uint16_t x_size_, uint16_t y_size_, uint16_t z_size_);
-    int getSize();
+    void setSize(uint32_t x_size_, uint32_t y_size_, uint32_t z_size_);
+    uint64_t getSize();
     glm::ivec3 getDimensions();
-    uint8_t read(int x, int y, int z);
-    void write(int x, int y, int z, uint8_t byte);
-    void writeToFile(std::string path);
+    uint8_t read(uint32_t x, uint32_t y, uint32_t z);
+    void write(uint32_t x, uint32_t y, uint32_t z, uint8_t byte);
+    void writeToFile(std::string path, StateFormat format = StateFormat::V2);
+    // Overwrites the chunks stored in a snapshot delta, returns its sequence number
+    uint32_t applySnapshotDelta(std::string path, uint16_t chunk_size = STATE_DEFAULT_CHUNK_SIZE);
+
+    void fillPerlin();
+
+    bool isPacked() const { return packing == VoxelPacking::NIBBLE; }
+    // Throws if a voxel doesn't fit in 4 bits
+    void pack();
+    void unpack();
 
-    void fillPerlin() { generator.generatePerlin2D(data.data(), x_size, y_size, z_size); }
+private:
+    void readV1(std::ifstream& file);
+    void readV2(std::string path);
+    void writeV1(std::string path);
 };
 
 }
@@ -0,0 +1,83 @@
+#include <cstring>
+#include "voxel_packing.h"
+
+namespace cscd {
+namespace file {
+
+// The kernels below work on 8 voxels (one 64 bit word) at a time and assume a
+// little endian host, so voxel 0 is the lowest byte of each word.
+
+bool fitsNibbles(const uint8_t* voxels, size_t count) {
+    size_t i = 0;
+    uint64_t high = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, voxels + i, 8);
+        high |= word;
+    }
+    if (high & 0xF0F0F0F0F0F0F0F0ull) {
+        return false;
+    }
+
+    for (; i < count; i++) {
+        if (voxels[i] > NIBBLE_MAX_VALUE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void packNibbles(const uint8_t* voxels, size_t count, uint8_t* packed) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, voxels + i, 8);
+
+        // Fold each pair of bytes into one, then squeeze the pairs together
+        word &= 0x0F0F0F0F0F0F0F0Full;
+        word = (word | (word >> 4)) & 0x00FF00FF00FF00FFull;
+        word = (word | (word >> 8)) & 0x0000FFFF0000FFFFull;
+        word = (word | (word >> 16)) & 0x00000000FFFFFFFFull;
+
+        uint32_t out = (uint32_t)word;
+        std::memcpy(packed + i / 2, &out, 4);
+    }
+
+    for (; i < count; i += 2) {
+        uint8_t low = voxels[i] & 0x0F;
+        uint8_t high = i + 1 < count ? voxels[i + 1] & 0x0F : 0;
+        packed[i / 2] = low | (high << 4);
+    }
+}
+
+void packNibblesAt(const uint8_t* voxels, size_t count, uint8_t* packed, size_t first) {
+    if (count != 0 && first % 2 == 1) {
+        writeNibble(packed, first, voxels[0]);
+        voxels++;
+        count--;
+        first++;
+    }
+    packNibbles(voxels, count, packed + first / 2);
+}
+
+void unpackNibbles(const uint8_t* packed, size_t count, uint8_t* voxels) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint32_t in;
+        std::memcpy(&in, packed + i / 2, 4);
+
+        uint64_t word = in;
+        word = (word | (word << 16)) & 0x0000FFFF0000FFFFull;
+        word = (word | (word << 8)) & 0x00FF00FF00FF00FFull;
+        word = (word | (word << 4)) & 0x0F0F0F0F0F0F0F0Full;
+
+        std::memcpy(voxels + i, &word, 8);
+    }
+
+    for (; i < count; i++) {
+        voxels[i] = readNibble(packed, i);
+    }
+}
+
+}
+}
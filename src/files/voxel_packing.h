@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace cscd {
+namespace file {
+
+// How voxels are stored. NIBBLE packs two voxels per byte, the even voxel in
+// the low nibble, and can only hold materials 0-15. BYTE stays available for
+// when the material count outgrows that.
+enum class VoxelPacking : uint8_t {
+    BYTE    = 0,
+    NIBBLE  = 1
+};
+
+#define NIBBLE_MAX_VALUE 15
+
+inline size_t packedSize(size_t voxel_count, VoxelPacking packing) {
+    return packing == VoxelPacking::NIBBLE ? (voxel_count + 1) / 2 : voxel_count;
+}
+
+// True if every voxel fits in a nibble
+bool fitsNibbles(const uint8_t* voxels, size_t count);
+// Only the low nibble of each voxel is kept, an odd trailing voxel leaves the high nibble zero
+void packNibbles(const uint8_t* voxels, size_t count, uint8_t* packed);
+void unpackNibbles(const uint8_t* packed, size_t count, uint8_t* voxels);
+// Packs voxels into packed starting at voxel first, keeping the voxel before
+// it that shares its byte. Lets a world be packed a slab at a time, front to back.
+void packNibblesAt(const uint8_t* voxels, size_t count, uint8_t* packed, size_t first);
+
+inline uint8_t readNibble(const uint8_t* packed, size_t index) {
+    return (packed[index >> 1] >> ((index & 1) << 2)) & 0x0F;
+}
+
+inline void writeNibble(uint8_t* packed, size_t index, uint8_t value) {
+    int shift = (index & 1) << 2;
+    packed[index >> 1] = (packed[index >> 1] & ~(0x0F << shift)) | ((value & 0x0F) << shift);
+}
+
+}
+}
@@ -0,0 +1,31 @@
+#include <cstring>
+#include <stdexcept>
+#include "world_source.h"
+
+namespace cscd {
+namespace file {
+
+void StateSource::decodeLayers(uint32_t z_begin, uint32_t z_count, uint8_t* layers) {
+    if ((uint64_t)z_begin + z_count > state.z_size) {
+        throw std::runtime_error("Layer range outside of the world!");
+    }
+
+    uint64_t begin = z_begin * getLayerSize();
+    uint64_t count = z_count * getLayerSize();
+    if (!state.isPacked()) {
+        std::memcpy(layers, state.data.data() + begin, count);
+        return;
+    }
+
+    // Unpacking works from whole bytes, so an odd first voxel is read on its own
+    if (begin % 2 == 1 && count > 0) {
+        layers[0] = readNibble(state.data.data(), begin);
+        layers++;
+        begin++;
+        count--;
+    }
+    unpackNibbles(state.data.data() + begin / 2, count, layers);
+}
+
+}
+}
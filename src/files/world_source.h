@@ -0,0 +1,43 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <stdint.h>
+#include "glm/glm.hpp"
+#include "files/state_file.h"
+
+namespace cscd {
+namespace file {
+
+// Anything the renderer can upload a world from, a z-layer range at a time.
+// Layers are always handed over one byte per voxel.
+class WorldSource {
+public:
+    virtual ~WorldSource() = default;
+
+    virtual glm::uvec3 getDimensions() const = 0;
+    uint64_t getSize() const { glm::uvec3 dimensions = getDimensions(); return (uint64_t)dimensions.x * dimensions.y * dimensions.z; }
+    uint64_t getLayerSize() const { glm::uvec3 dimensions = getDimensions(); return (uint64_t)dimensions.x * dimensions.y; }
+    // Layers per decode batch that avoid decoding anything more than once
+    virtual uint32_t getPreferredLayerBatch() const { return 1; }
+
+    // Decodes z-layers [z_begin, z_begin + z_count) into layers
+    virtual void decodeLayers(uint32_t z_begin, uint32_t z_count, uint8_t* layers) = 0;
+    // Hints that the given layers are wanted next
+    virtual void prefetchLayers(uint32_t z_begin, uint32_t z_count) {}
+};
+
+// A world built in memory, handed to the renderer without a file round trip
+class StateSource : public WorldSource {
+public:
+    StateSource(State&& state_) : state{std::move(state_)} {}
+
+    glm::uvec3 getDimensions() const override { return glm::uvec3(state.x_size, state.y_size, state.z_size); }
+    void decodeLayers(uint32_t z_begin, uint32_t z_count, uint8_t* layers) override;
+
+private:
+    State state;
+};
+
+}
+}
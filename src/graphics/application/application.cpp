@@ -9,6 +9,8 @@
 #include "glm/glm.hpp"
 #include "glm/gtc/constants.hpp"
 #include "application.h"
+#include "math/random/rng.h"
+#include "files/chunked_state.h"
 
 namespace cscd {
 
@@ -16,8 +18,155 @@ Application::Application(std::string state_path) :
     renderer{window, device, scene_info, state_path}
 {}
 
+Application::Application(file::State&& state) :
+    renderer{window, device, scene_info, std::move(state)}
+{}
+
+Application::Application(glm::ivec3 world_dimensions, const generation::TerrainSettings& terrain, bool stream) :
+    renderer{window, device, scene_info, world_dimensions, terrain, stream}
+{}
+
 Application::~Application() {}
 
+bool Application::verifyTerrain(const generation::TerrainSettings& terrain) {
+    glm::ivec3 world_dimensions = renderer.getWorldDimensions();
+    std::vector<uint8_t> generated;
+    renderer.downloadState(generated);
+
+    std::vector<uint8_t> expected(generated.size());
+    generation::TerrainGenerator generator{};
+    generator.settings = terrain;
+    generator.generatePerlin2D(expected.data(), world_dimensions.x, world_dimensions.y, world_dimensions.z);
+
+    uint64_t mismatches = 0;
+    for (size_t i = 0; i < generated.size(); i++) {
+        if (generated[i] == expected[i]) {
+            continue;
+        }
+        if (mismatches < 16) {
+            size_t layer_size = (size_t)world_dimensions.x * world_dimensions.y;
+            std::cerr << "Generated voxel (" << i % world_dimensions.x << ", " << (i % layer_size) / world_dimensions.x << ", " << i / layer_size
+                      << ") is " << (int)generated[i] << " on the GPU but " << (int)expected[i] << " on the CPU" << std::endl;
+        }
+        mismatches++;
+    }
+
+    if (mismatches == 0) {
+        logger.log(Logger::LOG_LEVEL_INFO, "GPU terrain matches the CPU generator (" + std::to_string(generated.size()) + " voxels)");
+    } else {
+        logger.log(Logger::LOG_LEVEL_ERROR, "GPU terrain differs from the CPU generator in " + std::to_string(mismatches) + " voxels");
+    }
+    return mismatches == 0;
+}
+
+void Application::recordJournal(std::string path, uint32_t seed, uint32_t hash_interval) {
+    glm::ivec3 world_dimensions = renderer.getWorldDimensions();
+
+    file::JournalHeader header{};
+    header.chunk_size = scene_info.chunk_size;
+    header.x_size = world_dimensions.x;
+    header.y_size = world_dimensions.y;
+    header.z_size = world_dimensions.z;
+    header.base_seed = seed;
+    header.hash_interval = hash_interval;
+
+    journal_writer = std::make_unique<file::JournalWriter>(path, header);
+    seed_stream.seed(seed);
+}
+
+void Application::replayJournal(std::string path) {
+    replay_journal = std::make_unique<file::Journal>(file::readJournal(path));
+
+    const file::JournalHeader& header = replay_journal->header;
+    glm::ivec3 world_dimensions = renderer.getWorldDimensions();
+    if (header.x_size != world_dimensions.x || header.y_size != world_dimensions.y || header.z_size != world_dimensions.z ||
+        header.chunk_size != scene_info.chunk_size) {
+        throw std::runtime_error("Journal was recorded against a different world!");
+    }
+}
+
+void Application::editVoxel(glm::ivec3 location, uint8_t value) {
+    pending_edits.push_back(file::JournalEdit{location, value});
+}
+
+// Returns the frame time to step physics by, the recorded one when replaying
+float Application::beginJournalFrame(float frame_time) {
+    file::JournalFrame frame{};
+    if (replay_journal) {
+        frame = replay_journal->frames[frame_number];
+        if (frame.has_camera) {
+            scene_info.old_camera_position = scene_info.camera_position;
+            scene_info.old_camera_direction = scene_info.camera_direction;
+            scene_info.camera_position = frame.camera_position;
+            scene_info.camera_direction = frame.camera_direction;
+        }
+    } else {
+        frame.seed = seed_stream();
+        frame.frame_time = frame_time;
+        frame.has_camera = true;
+        frame.camera_position = scene_info.camera_position;
+        frame.camera_direction = scene_info.camera_direction;
+        frame.edits = std::move(pending_edits);
+    }
+    pending_edits.clear();
+
+    // Every random choice made while rendering this frame comes from its seed
+    Rand::seed(frame.seed);
+    for (auto& edit : frame.edits) {
+        renderer.queueEdit(edit.location, edit.value);
+    }
+
+    if (journal_writer) {
+        journal_writer->writeFrame(frame);
+        uint32_t hash_interval = journal_writer->getHeader().hash_interval;
+        if (hash_interval != 0 && frame_number % hash_interval == 0) {
+            renderer.requestChunkHashes(frame_number);
+        }
+    } else if (replay_journal && replay_journal->chunk_hashes.count(frame_number)) {
+        renderer.requestChunkHashes(frame_number);
+    }
+
+    return frame.frame_time;
+}
+
+void Application::checkChunkHashes() {
+    uint32_t frame;
+    std::vector<uint32_t> hashes;
+    if (!renderer.collectChunkHashes(frame, hashes)) {
+        return;
+    }
+
+    if (journal_writer) {
+        journal_writer->writeChunkHashes(frame, hashes);
+        journal_writer->flush();
+        return;
+    } else if (!replay_journal) {
+        return;
+    }
+
+    const std::vector<uint32_t>& expected = replay_journal->chunk_hashes[frame];
+    if (expected.size() != hashes.size()) {
+        throw std::runtime_error("Journal chunk hashes don't match the world's chunk count!");
+    }
+
+    glm::ivec3 world_dimensions = renderer.getWorldDimensions();
+    file::ChunkGrid grid{glm::uvec3(world_dimensions), (uint32_t)scene_info.chunk_size};
+    for (uint32_t i = 0; i < hashes.size(); i++) {
+        if (hashes[i] == expected[i]) {
+            continue;
+        }
+        if (hash_mismatches == 0) {
+            first_mismatch_frame = frame;
+        }
+        if (hash_mismatches < 16) {
+            glm::uvec3 chunk = grid.chunkCoords(i);
+            std::cerr << "Replay diverged at frame " << frame << " in chunk " << i
+                      << " (" << chunk.x << ", " << chunk.y << ", " << chunk.z << ")" << std::endl;
+        }
+        hash_mismatches++;
+    }
+}
+
 void Application::run() {
     KeyboardInputController camera_controller{};
 
@@ -26,6 +175,8 @@ void Application::run() {
     });
     
     auto curr_time = std::chrono::high_resolution_clock::now();
+    auto next_frame = curr_time;
+    float snapshot_timer = 0.0f;
     while (!window.shouldClose()) {
         glfwPollEvents();
 
@@ -34,18 +185,57 @@ void Application::run() {
         curr_time = new_time;
         std::cout << std::to_string(1.0f / frame_time) << std::endl;
 
-        camera_controller.update(window.getGLFWWindow(), frame_time, scene_info);
+        if (replay_journal && frame_number >= replay_journal->frames.size()) {
+            break;
+        } else if (!replay_journal) {
+            camera_controller.update(window.getGLFWWindow(), frame_time, scene_info);
+        }
+
+        float snapshot_interval = renderer.getRendererSettings().snapshot_interval;
+        snapshot_timer += frame_time;
+        if (snapshot_interval > 0.0f && snapshot_timer >= snapshot_interval && renderer.requestSnapshot()) {
+            snapshot_timer = 0.0f;
+        }
 
         //printf("x: %f\ty: %f\tz: %f\n", scene_info.camera_position.x, scene_info.camera_position.y, scene_info.camera_position.z);
         //printf("x: %f\ty: %f\tz: %f\n\n\n", scene_info.camera_direction.x, scene_info.camera_direction.y, scene_info.camera_direction.z);
         
         if (auto command_buffer = renderer.beginFrame()) {
-            renderer.render();
+            // The previous frame has retired once beginFrame returns
+            checkChunkHashes();
+            float physics_time = beginJournalFrame(frame_time);
+
+            renderer.render(physics_time);
             renderer.endFrame();
+            frame_number++;
+        }
+
+        float render_rate = renderer.getRendererSettings().render_rate;
+        if (render_rate > 0.0f) {
+            // A running deadline, so a frame that overran shortens the next sleep.
+            // Over a frame behind, start again from now rather than rushing frames.
+            auto period = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<float>(1.0f / render_rate));
+            next_frame += period;
+            auto now = std::chrono::high_resolution_clock::now();
+            if (now - next_frame > period) {
+                next_frame = now;
+            }
+            std::this_thread::sleep_until(next_frame);
+        } else {
+            next_frame = std::chrono::high_resolution_clock::now();
         }
     }
 
     vkDeviceWaitIdle(device.device());
+    checkChunkHashes();
+
+    if (replay_journal) {
+        if (hash_mismatches == 0) {
+            std::cout << "Replay of " << frame_number << " frames matched the recording" << std::endl;
+        } else {
+            std::cout << "Replay diverged: " << hash_mismatches << " chunk mismatches, first at frame " << first_mismatch_frame << std::endl;
+        }
+    }
     //stop_config_ui = true;
     config_thread.join();
 }
@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 #include <atomic>
+#include <random>
 #include <SFML/Graphics.hpp>
 #include <TGUI/TGUI.hpp>
 #include <TGUI/Backend/SFML-Graphics.hpp>
@@ -12,6 +13,7 @@
 #include "graphics/renderer/renderer.h"
 #include "input/keyboard_input_controller.h"
 #include "files/state_file.h"
+#include "files/journal_file.h"
 #include "log/log.h"
 
 #define CONFIG_GUI
@@ -31,6 +33,11 @@ public:
 
     Application() = delete;
     Application(std::string state_path);
+    // The world is moved straight into the renderer, no state file is written
+    Application(file::State&& state);
+    // Procedural session, the world is generated on the GPU. A streamed session
+    // keeps a world_dimensions window of an unbounded world around the camera.
+    Application(glm::ivec3 world_dimensions, const generation::TerrainSettings& terrain, bool stream = false);
     ~Application();
 
     Application(const Application&) = delete;
@@ -38,6 +45,16 @@ public:
 
     void run();
 
+    // Records the seeds, camera and edits of every frame plus chunk hashes every hash_interval frames
+    void recordJournal(std::string path, uint32_t seed, uint32_t hash_interval = 60);
+    // Plays a recorded run back and checks the world against its chunk hashes
+    void replayJournal(std::string path);
+    void editVoxel(glm::ivec3 location, uint8_t value);
+    // Can be switched between frames, e.g. to compare kernels on the same world
+    void setPhysicsKernel(PhysicsKernel kernel) { renderer.getRendererSettings().physics_kernel = kernel; }
+    // Compares the GPU generated world against TerrainGenerator, returns false if any voxel differs
+    bool verifyTerrain(const generation::TerrainSettings& terrain);
+
     float mapSliderToPhi(int slider_val);
     int mapPhiToSlider(float phi_val);
     void configWindow();
@@ -50,6 +67,9 @@ public:
     void numberBoxUpdate(tgui::EditBox::Ptr& editbox, int& number_setting);
 
 private:
+    float beginJournalFrame(float frame_time);
+    void checkChunkHashes();
+
     SceneInfo scene_info{};
     
     Window window{WIDTH, HEIGHT, "Hello Vulkan!"};
@@ -58,6 +78,14 @@ private:
     Logger logger;
 
     std::atomic_bool stop_config_ui = false;
+
+    std::minstd_rand seed_stream{std::random_device{}()};
+    uint32_t frame_number = 0;
+    std::vector<file::JournalEdit> pending_edits;
+    std::unique_ptr<file::JournalWriter> journal_writer;
+    std::unique_ptr<file::Journal> replay_journal;
+    uint32_t hash_mismatches = 0;
+    uint32_t first_mismatch_frame = 0;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include "physics_benchmark.h"
+#include "graphics/device/device.h"
+#include "graphics/renderer/renderer.h"
+#include "physics/simulation/cpu_simulator.h"
+#include "math/random/rng.h"
+
+namespace cscd {
+
+void PhysicsBenchmark::run() {
+    if (settings.steps == 0) {
+        throw std::runtime_error("Benchmark needs at least one step!");
+    }
+
+    file::State state{settings.state_path};
+    if (state.isPacked()) {
+        state.unpack();
+    }
+    glm::ivec3 dimensions = state.getDimensions();
+    std::cout << "World: " << dimensions.x << "x" << dimensions.y << "x" << dimensions.z << ", " << settings.steps << " steps, seed " << settings.seed << std::endl;
+
+    // Both backends draw their pass offsets from Rand in the same order
+    Rand::seed(settings.seed);
+    if (settings.cpu) {
+        runCpu(state);
+    } else {
+        runGpu(std::move(state));
+    }
+}
+
+void PhysicsBenchmark::runGpu(file::State&& state) {
+    glm::ivec3 dimensions = state.getDimensions();
+
+    Device device{};
+    SceneInfo scene_info{};
+    Renderer renderer{device, scene_info, std::move(state)};
+    renderer.getRendererSettings().physics_kernel = settings.kernel;
+
+    PhysicsTimings timings{};
+    for (uint32_t step = 0; step < settings.steps; step++) {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        renderer.simulate(timings);
+        auto end_time = std::chrono::high_resolution_clock::now();
+        double step_ms = std::chrono::duration<double, std::chrono::milliseconds::period>(end_time - start_time).count();
+
+        total_compact_ms += timings.compact_ms;
+        total_pass_ms.resize(timings.pass_ms.size(), 0.0);
+        for (size_t i = 0; i < timings.pass_ms.size(); i++) {
+            total_pass_ms[i] += timings.pass_ms[i];
+        }
+        reportStep(step, renderer.getPhysicsCounters(), step_ms);
+    }
+    reportSummary(scene_info.chunk_size);
+
+    if (!settings.output_path.empty()) {
+        std::vector<uint8_t> voxels;
+        renderer.downloadState(voxels);
+        file::State final_state{(uint32_t)dimensions.x, (uint32_t)dimensions.y, (uint32_t)dimensions.z, voxels.data()};
+        final_state.writeToFile(settings.output_path);
+        std::cout << "Wrote " << settings.output_path << std::endl;
+    }
+}
+
+void PhysicsBenchmark::runCpu(file::State& state) {
+    physics::CpuSimulator simulator{state};
+    for (uint32_t step = 0; step < settings.steps; step++) {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        simulator.step();
+        auto end_time = std::chrono::high_resolution_clock::now();
+        double step_ms = std::chrono::duration<double, std::chrono::milliseconds::period>(end_time - start_time).count();
+
+        reportStep(step, simulator.getCounters(), step_ms);
+    }
+    reportSummary(CPU_PHYSICS_CHUNK_SIZE);
+
+    if (!settings.output_path.empty()) {
+        state.writeToFile(settings.output_path);
+        std::cout << "Wrote " << settings.output_path << std::endl;
+    }
+}
+
+void PhysicsBenchmark::reportStep(uint32_t step, const PhysicsCounters& counters, double step_ms) {
+    total_seconds += step_ms / 1000.0;
+    total_active_cells += counters.active_cells;
+    total_awake_chunks += counters.awake_chunks;
+    peak_awake_chunks = std::max(peak_awake_chunks, counters.awake_chunks);
+
+    std::cout << "Step " << step << ": " << counters.awake_chunks << " active chunks (+" << counters.woken_chunks << " -" << counters.slept_chunks << "), "
+              << counters.active_cells << " cells, " << std::fixed << std::setprecision(3) << step_ms << " ms" << std::defaultfloat << std::endl;
+}
+
+void PhysicsBenchmark::reportSummary(int chunk_size) {
+    uint64_t cell_voxels = (uint64_t)chunk_size * chunk_size * chunk_size;
+    double voxel_updates = (double)total_active_cells * cell_voxels;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Total time: " << total_seconds << " s" << std::endl;
+    std::cout << "Voxel updates/s: " << std::setprecision(0) << voxel_updates / total_seconds << std::setprecision(3) << std::endl;
+    std::cout << "Active chunks per step: " << (double)total_awake_chunks / settings.steps << " mean, " << peak_awake_chunks << " peak" << std::endl;
+    if (!total_pass_ms.empty()) {
+        std::cout << "GPU time per step:" << std::endl;
+        std::cout << "\tcompact: " << total_compact_ms / settings.steps << " ms" << std::endl;
+        for (size_t i = 0; i < total_pass_ms.size(); i++) {
+            std::cout << "\tpass " << i << ": " << total_pass_ms[i] / settings.steps << " ms" << std::endl;
+        }
+    }
+    std::cout << std::defaultfloat;
+}
+
+}
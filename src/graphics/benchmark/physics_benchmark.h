@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "files/state_file.h"
+#include "settings/settings.h"
+
+namespace cscd {
+
+struct BenchmarkSettings {
+    std::string state_path;
+    std::string output_path; // Final state isn't written if empty
+    uint32_t steps = 1000;
+    uint32_t seed = 0;
+    bool cpu = false; // CpuSimulator instead of a headless device
+    PhysicsKernel kernel = PhysicsKernel::SERIAL; // GPU only, the CPU runs the serial passes
+};
+
+// Runs physics alone over a state file, with no window or swap chain, to
+// measure simulation throughput. Prints each step's activity as it goes and
+// a summary at the end.
+//
+// A voxel update is a voxel in a cell physics ran over, whether or not it
+// moved, so the figure is comparable between kernels and the CPU.
+class PhysicsBenchmark {
+public:
+    PhysicsBenchmark(const BenchmarkSettings& settings_) : settings{settings_} {}
+
+    void run();
+
+private:
+    void runGpu(file::State&& state);
+    void runCpu(file::State& state);
+    void reportStep(uint32_t step, const PhysicsCounters& counters, double step_ms);
+    void reportSummary(int chunk_size);
+
+    BenchmarkSettings settings;
+
+    double total_seconds = 0.0;
+    uint64_t total_active_cells = 0;
+    uint64_t total_awake_chunks = 0;
+    uint32_t peak_awake_chunks = 0;
+    // GPU only, summed over every step
+    double total_compact_ms = 0.0;
+    std::vector<double> total_pass_ms;
+};
+
+}
@@ -137,6 +137,24 @@ DescriptorWriter &DescriptorWriter::writeBuffer(uint32_t binding, VkDescriptorBu
     return *this;
 }
  
+DescriptorWriter &DescriptorWriter::writeBuffers(uint32_t binding, VkDescriptorBufferInfo *bufferInfos, uint32_t count) {
+    assert(setLayout.bindings.count(binding) == 1 && "Layout does not contain specified binding");
+
+    auto &bindingDescription = setLayout.bindings[binding];
+
+    assert(bindingDescription.descriptorCount == count && "Buffer info count doesn't match binding");
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.descriptorType = bindingDescription.descriptorType;
+    write.dstBinding = binding;
+    write.pBufferInfo = bufferInfos;
+    write.descriptorCount = count;
+
+    writes.push_back(write);
+    return *this;
+}
+
 DescriptorWriter &DescriptorWriter::writeImage(uint32_t binding, VkDescriptorImageInfo *imageInfo) {
     assert(setLayout.bindings.count(binding) == 1 && "Layout does not contain specified binding");
 
@@ -86,6 +86,7 @@ public:
     DescriptorWriter(DescriptorSetLayout &setLayout, DescriptorPool &pool);
 
     DescriptorWriter &writeBuffer(uint32_t binding, VkDescriptorBufferInfo *bufferInfo);
+    DescriptorWriter &writeBuffers(uint32_t binding, VkDescriptorBufferInfo *bufferInfos, uint32_t count);
     DescriptorWriter &writeImage(uint32_t binding, VkDescriptorImageInfo *imageInfo);
 
     bool build(VkDescriptorSet &set);
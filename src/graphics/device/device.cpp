@@ -45,7 +45,15 @@ void DestroyDebugUtilsMessengerEXT(
 }
 
 // Class member functions
-Device::Device(Window &window) : window{window} {
+Device::Device(Window &window) : Device(&window) {}
+
+Device::Device() : Device(nullptr) {}
+
+Device::Device(Window *window_) : window{window_} {
+    if (!window) {
+        device_extensions.clear();
+    }
+
     createInstance();
     if (enable_validation_layers) {
         setupDebugMessenger();
@@ -59,6 +67,7 @@ Device::Device(Window &window) : window{window} {
 
 Device::~Device() {
     vkDestroyCommandPool(device_, command_pool, nullptr);
+    vkDestroyCommandPool(device_, physics_command_pool, nullptr);
     vmaDestroyAllocator(allocator_);
     vkDestroyDevice(device_, nullptr);
 
@@ -134,6 +143,12 @@ void Device::pickPhysicalDevice() {
         throw std::runtime_error("Failed to find a suitable GPU!");
     }
 
+    subgroup_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &subgroup_properties;
+    vkGetPhysicalDeviceProperties2(physical_device, &properties2);
+
     std::cout << "API Version: " << std::to_string(VK_API_VERSION_MAJOR(properties.apiVersion)) << "." << std::to_string(VK_API_VERSION_MINOR(properties.apiVersion)) << std::endl;
     std::cout << "Physical device: " << properties.deviceName << std::endl;
 }
@@ -143,14 +158,24 @@ void Device::createLogicalDevice() {
 
     std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
     std::set<uint32_t> unique_queue_families = {indices.compute_family.value(), indices.present_family.value()};
+    if (indices.physics_family.has_value()) {
+        unique_queue_families.insert(indices.physics_family.value());
+    }
 
-    float queue_priority = 1.0f;
+    // Without a second family, physics gets a second queue of the compute family if it has one
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families.data());
+    bool second_compute_queue = !indices.physics_family.has_value() && queue_families[indices.compute_family.value()].queueCount > 1;
+
+    float queue_priorities[] = {1.0f, 1.0f};
     for (uint32_t queue_family : unique_queue_families) {
         VkDeviceQueueCreateInfo queue_create_info{};
         queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queue_create_info.queueFamilyIndex = queue_family;
-        queue_create_info.queueCount = 1;
-        queue_create_info.pQueuePriorities = &queue_priority;
+        queue_create_info.queueCount = (second_compute_queue && queue_family == indices.compute_family.value()) ? 2 : 1;
+        queue_create_info.pQueuePriorities = queue_priorities;
         queue_create_infos.push_back(queue_create_info);
     }
 
@@ -164,6 +189,7 @@ void Device::createLogicalDevice() {
     extra_features.storageBuffer8BitAccess = VK_TRUE;
     extra_features.shaderInt8 = VK_TRUE;
     extra_features.scalarBlockLayout = VK_TRUE;
+    extra_features.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
     extra_features.pNext = &extra_features2;
 
     VkPhysicalDeviceFeatures2 device_features = {};
@@ -195,6 +221,15 @@ void Device::createLogicalDevice() {
 
     vkGetDeviceQueue(device_, indices.compute_family.value(), 0, &compute_queue_);
     vkGetDeviceQueue(device_, indices.present_family.value(), 0, &present_queue_);
+    if (indices.physics_family.has_value()) {
+        vkGetDeviceQueue(device_, indices.physics_family.value(), 0, &physics_queue_);
+        shared_queue_families = {indices.compute_family.value(), indices.physics_family.value()};
+    } else if (second_compute_queue) {
+        vkGetDeviceQueue(device_, indices.compute_family.value(), 1, &physics_queue_);
+    } else {
+        physics_queue_ = compute_queue_;
+    }
+    std::cout << "Async physics: " << (hasAsyncCompute() ? "yes" : "no") << std::endl;
 }
 
 void Device::createCommandPool() {
@@ -208,10 +243,27 @@ void Device::createCommandPool() {
     if (vkCreateCommandPool(device_, &pool_info, nullptr, &command_pool) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create command pool!");
     }
+
+    pool_info.queueFamilyIndex = queue_family_indices.physics_family.value_or(queue_family_indices.compute_family.value());
+    if (vkCreateCommandPool(device_, &pool_info, nullptr, &physics_command_pool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create physics command pool!");
+    }
+}
+
+void Device::setSharedQueueFamilies(VkBufferCreateInfo& create_info) {
+    if (shared_queue_families.empty()) {
+        create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        return;
+    }
+    create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    create_info.queueFamilyIndexCount = static_cast<uint32_t>(shared_queue_families.size());
+    create_info.pQueueFamilyIndices = shared_queue_families.data();
 }
 
 void Device::createSurface() {
-    window.createWindowSurface(instance, &surface_);
+    if (window) {
+        window->createWindowSurface(instance, &surface_);
+    }
 }
 
 bool Device::isDeviceSuitable(VkPhysicalDevice device) {
@@ -219,8 +271,8 @@ bool Device::isDeviceSuitable(VkPhysicalDevice device) {
 
     bool extensions_supported = checkDeviceExtensionSupport(device);
 
-    bool swap_chain_adequate = false;
-    if (extensions_supported) {
+    bool swap_chain_adequate = !window;
+    if (extensions_supported && window) {
         SwapChainSupportDetails swap_chain_support = querySwapChainSupport(device);
         swap_chain_adequate = !swap_chain_support.formats.empty() && !swap_chain_support.present_modes.empty();
         if (!(swap_chain_support.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT)) {
@@ -238,7 +290,7 @@ bool Device::isDeviceSuitable(VkPhysicalDevice device) {
     supported_features.pNext = &extra_features;
     vkGetPhysicalDeviceFeatures2(device, &supported_features);
 
-    return indices.isComplete() && extensions_supported && swap_chain_adequate && supported_features.features.samplerAnisotropy && extra_features.storageBuffer8BitAccess && extra_features2.synchronization2;
+    return indices.isComplete() && extensions_supported && swap_chain_adequate && supported_features.features.samplerAnisotropy && extra_features.storageBuffer8BitAccess && extra_features.shaderStorageBufferArrayNonUniformIndexing && extra_features2.synchronization2;
 }
 
 void Device::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &create_info) {
@@ -284,10 +336,12 @@ bool Device::checkValidationLayerSupport() {
 }
 
 std::vector<const char *> Device::getRequiredExtensions() {
-    uint32_t glfw_extension_count = 0;
-    const char **glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-
-    std::vector<const char *> extensions(glfw_extensions, glfw_extensions + glfw_extension_count);
+    std::vector<const char *> extensions;
+    if (window) {
+        uint32_t glfw_extension_count = 0;
+        const char **glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+        extensions.assign(glfw_extensions, glfw_extensions + glfw_extension_count);
+    }
 
     if (enable_validation_layers) {
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -361,8 +415,13 @@ QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
             indices.compute_family = i;
         }
 
+        // Nothing is presented when headless, the compute queue stands in
         VkBool32 present_support = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &present_support);
+        if (window) {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &present_support);
+        } else {
+            present_support = indices.compute_family.has_value() && indices.compute_family.value() == (uint32_t)i;
+        }
         if (queue_family.queueCount > 0 && present_support) {
             indices.present_family = i;
         }
@@ -374,6 +433,19 @@ QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
         i++;
     }
 
+    // Physics can overlap rendering on a second compute family, dedicated compute families first
+    if (indices.compute_family.has_value()) {
+        for (uint32_t j = 0; j < queue_family_count; j++) {
+            const VkQueueFamilyProperties& queue_family = queue_families[j];
+            if (j == indices.compute_family.value() || queue_family.queueCount == 0 || !(queue_family.queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+                continue;
+            }
+            if (!indices.physics_family.has_value() || !(queue_family.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                indices.physics_family = j;
+            }
+        }
+    }
+
     return indices;
 }
 
@@ -19,6 +19,7 @@ struct SwapChainSupportDetails {
 struct QueueFamilyIndices {
     std::optional<uint32_t> compute_family;
     std::optional<uint32_t> present_family;
+    std::optional<uint32_t> physics_family; // Another family that can run compute, if there is one
     bool isComplete() { return compute_family.has_value() && present_family.has_value(); }
 };
 
@@ -31,6 +32,9 @@ public:
 #endif
 
     Device(Window &window);
+    // Headless, for running compute without a window. There's no surface,
+    // present queue or swap chain support.
+    Device();
     ~Device();
 
     // Not copyable or movable
@@ -40,16 +44,22 @@ public:
     Device& operator=(Device &&) = delete;
 
     VkCommandPool getCommandPool() { return command_pool; }
+    VkCommandPool getPhysicsCommandPool() { return physics_command_pool; }
     VmaAllocator allocator() { return allocator_; }
     VkDevice device() { return device_; }
     VkSurfaceKHR surface() { return surface_; }
     VkQueue computeQueue() { return compute_queue_; }
     VkQueue presentQueue() { return present_queue_; }
+    // The compute queue itself when the device only has the one
+    VkQueue physicsQueue() { return physics_queue_; }
+    bool hasAsyncCompute() { return physics_queue_ != compute_queue_; }
 
     SwapChainSupportDetails getSwapChainSupport() { return querySwapChainSupport(physical_device); }
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
     QueueFamilyIndices findPhysicalQueueFamilies() { return findQueueFamilies(physical_device); }
     bool checkFormatSupport(VkFormat format, VkFormatFeatureFlags requestedSupport);
+    // Buffers used from both the compute and physics queues must be shared when they're different families
+    void setSharedQueueFamilies(VkBufferCreateInfo& create_info);
 
     void createImageWithInfo(
         const VkImageCreateInfo &imageInfo,
@@ -59,8 +69,11 @@ public:
     );
 
     VkPhysicalDeviceProperties properties;
+    VkPhysicalDeviceSubgroupProperties subgroup_properties{};
 
 private:
+    Device(Window *window_);
+
     void createInstance();
     void setupDebugMessenger();
     void createSurface();
@@ -84,16 +97,19 @@ private:
     VkInstance instance;
     VkDebugUtilsMessengerEXT debug_messenger;
     VkPhysicalDevice physical_device = VK_NULL_HANDLE;
-    Window& window;
+    Window* window; // Null when headless
     VkCommandPool command_pool;
+    VkCommandPool physics_command_pool;
 
     VkDevice device_;
-    VkSurfaceKHR surface_;
+    VkSurfaceKHR surface_ = VK_NULL_HANDLE;
     VkQueue compute_queue_;
     VkQueue present_queue_;
+    VkQueue physics_queue_;
+    std::vector<uint32_t> shared_queue_families;
 
     const std::vector<const char *> validation_layers = {"VK_LAYER_KHRONOS_validation"};
-    const std::vector<const char *> device_extensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    std::vector<const char *> device_extensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include <cstring>
+#include <stdexcept>
+#include "edit_queue.h"
+
+namespace cscd {
+
+EditQueue::EditQueue(Device& device_, std::vector<VkDescriptorSetLayout> world_set_layouts, const std::string& shader_path) :
+    device{device_}
+{
+    createDescriptors();
+    createEditBuffer(INITIAL_CAPACITY);
+
+    VkPushConstantRange push_const_range{};
+    push_const_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_const_range.offset = 0;
+    push_const_range.size = sizeof(uint32_t);
+    std::vector<VkPushConstantRange> push_const_ranges = { push_const_range };
+    world_set_layouts.push_back(edit_set_layout->getDescriptorSetLayout());
+    edit_pipeline = std::make_unique<Pipeline>(device, shader_path, world_set_layouts, push_const_ranges);
+}
+
+EditQueue::~EditQueue() {
+    vmaDestroyBuffer(device.allocator(), edit_buffer, edit_allocation);
+}
+
+void EditQueue::createDescriptors() {
+    edit_set_layout = DescriptorSetLayout::Builder(device)
+    .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+    .build();
+
+    edit_pool = DescriptorPool::Builder(device)
+    .setMaxSets(1)
+    .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
+    .build();
+
+    if (!edit_pool->allocateDescriptor(edit_set_layout->getDescriptorSetLayout(), edit_descriptor_set)) {
+        throw std::runtime_error("Failed to allocate edit descriptor set!");
+    }
+}
+
+void EditQueue::createEditBuffer(uint32_t capacity_) {
+    // Only one frame is ever in flight, so the old buffer is no longer in use
+    if (edit_buffer != VK_NULL_HANDLE) {
+        vmaDestroyBuffer(device.allocator(), edit_buffer, edit_allocation);
+    }
+    capacity = capacity_;
+
+    VkBufferCreateInfo buffer_create_info{};
+    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.size = sizeof(uint32_t) + capacity * sizeof(Edit);
+    buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    VmaAllocationCreateInfo allocation_info{};
+    allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+    allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    if (vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &edit_buffer, &edit_allocation, &edit_info) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create edit buffer!");
+    }
+
+    VkDescriptorBufferInfo buffer_info{};
+    buffer_info.buffer = edit_buffer;
+    buffer_info.offset = 0;
+    buffer_info.range = VK_WHOLE_SIZE;
+
+    DescriptorWriter(*edit_set_layout, *edit_pool)
+    .writeBuffer(0, &buffer_info)
+    .overwrite(edit_descriptor_set);
+}
+
+void EditQueue::push(glm::ivec3 location, uint8_t value) {
+    edits.push_back(Edit{location, value});
+}
+
+void EditQueue::record(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets, uint32_t physics_frame) {
+    if (edits.empty()) {
+        return;
+    }
+
+    if (edits.size() > capacity) {
+        uint32_t new_capacity = capacity;
+        while (new_capacity < edits.size()) {
+            new_capacity *= 2;
+        }
+        createEditBuffer(new_capacity);
+    }
+
+    uint32_t edit_count = edits.size();
+    uint8_t* mapped = static_cast<uint8_t*>(edit_info.pMappedData);
+    std::memcpy(mapped, &edit_count, sizeof(uint32_t));
+    std::memcpy(mapped + sizeof(uint32_t), edits.data(), edit_count * sizeof(Edit));
+    vmaFlushAllocation(device.allocator(), edit_allocation, 0, VK_WHOLE_SIZE);
+    edits.clear();
+
+    std::vector<VkDescriptorSet> descriptor_sets = world_descriptor_sets;
+    descriptor_sets.push_back(edit_descriptor_set);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, edit_pipeline->getPipeline());
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, edit_pipeline->getPipelineLayout(), 0, descriptor_sets.size(), descriptor_sets.data(), 0, nullptr);
+    vkCmdPushConstants(command_buffer, edit_pipeline->getPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &physics_frame);
+    vkCmdDispatch(command_buffer, 1, 1, 1);
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT_KHR | VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <memory>
+#include <vector>
+#include <string>
+#include "glm/glm.hpp"
+#include "graphics/device/device.h"
+#include "graphics/pipeline/pipeline.h"
+#include "graphics/descriptors/descriptors.h"
+
+namespace cscd {
+
+// Collects voxel writes made from the host and applies them to the world at
+// the start of the next frame, before physics runs.
+class EditQueue {
+public:
+    static constexpr uint32_t INITIAL_CAPACITY = 1024;
+
+    EditQueue(Device& device_, std::vector<VkDescriptorSetLayout> world_set_layouts, const std::string& shader_path);
+    ~EditQueue();
+
+    EditQueue(const EditQueue&) = delete;
+    EditQueue& operator=(const EditQueue&) = delete;
+
+    void push(glm::ivec3 location, uint8_t value);
+    // Must be recorded before physics, world_descriptor_sets match world_set_layouts.
+    // Edited chunks are woken as of physics_frame.
+    void record(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets, uint32_t physics_frame);
+
+private:
+    struct Edit {
+        glm::ivec3 location;
+        uint32_t value;
+    };
+
+    void createEditBuffer(uint32_t capacity_);
+    void createDescriptors();
+
+    Device& device;
+    std::vector<Edit> edits;
+
+    uint32_t capacity = 0;
+    VkBuffer edit_buffer = VK_NULL_HANDLE;
+    VmaAllocation edit_allocation = VK_NULL_HANDLE;
+    VmaAllocationInfo edit_info{};
+
+    std::unique_ptr<Pipeline> edit_pipeline;
+    std::unique_ptr<DescriptorSetLayout> edit_set_layout{};
+    std::unique_ptr<DescriptorPool> edit_pool{};
+    VkDescriptorSet edit_descriptor_set = VK_NULL_HANDLE;
+};
+
+}
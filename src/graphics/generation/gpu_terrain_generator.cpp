@@ -0,0 +1,45 @@
+#include "gpu_terrain_generator.h"
+
+namespace cscd {
+
+GpuTerrainGenerator::GpuTerrainGenerator(Device& device_, std::vector<VkDescriptorSetLayout> world_set_layouts, const std::string& shader_path) :
+    device{device_}
+{
+    VkPushConstantRange push_const_range{};
+    push_const_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    push_const_range.offset = 0;
+    push_const_range.size = sizeof(GeneratePushConstant);
+    std::vector<VkPushConstantRange> push_const_ranges = { push_const_range };
+
+    generate_pipeline = std::make_unique<Pipeline>(device, shader_path, world_set_layouts, push_const_ranges);
+}
+
+void GpuTerrainGenerator::record(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets,
+                                 glm::ivec3 world_dimensions, const generation::TerrainSettings& settings) {
+    GeneratePushConstant push_constant{};
+    push_constant.seed = settings.seed;
+    push_constant.octaves = settings.octaves;
+    push_constant.terrain_ratio = settings.terrain_ratio;
+    push_constant.frequency = settings.frequency;
+    push_constant.fractal_bounding = generation::fractalBounding(settings.octaves);
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, generate_pipeline->getPipeline());
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, generate_pipeline->getPipelineLayout(), 0, world_descriptor_sets.size(), world_descriptor_sets.data(), 0, nullptr);
+    vkCmdPushConstants(command_buffer, generate_pipeline->getPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GeneratePushConstant), &push_constant);
+    vkCmdDispatch(command_buffer, (world_dimensions.x + LOCAL_SIZE - 1) / LOCAL_SIZE, world_dimensions.z, 1);
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT_KHR | VK_ACCESS_2_SHADER_WRITE_BIT_KHR | VK_ACCESS_2_TRANSFER_READ_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+}
+
+}
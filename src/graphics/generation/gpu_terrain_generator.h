@@ -0,0 +1,37 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <memory>
+#include <vector>
+#include <string>
+#include "glm/glm.hpp"
+#include "graphics/device/device.h"
+#include "graphics/pipeline/pipeline.h"
+#include "math/generation/terrain_generator.h"
+#include "settings/settings.h"
+
+namespace cscd {
+
+// Generates the same Perlin terrain as TerrainGenerator::generatePerlin2D
+// straight into the device local world, so procedural sessions skip host
+// generation, the state file and the upload.
+class GpuTerrainGenerator {
+public:
+    static constexpr uint32_t LOCAL_SIZE = 64;
+
+    GpuTerrainGenerator(Device& device_, std::vector<VkDescriptorSetLayout> world_set_layouts, const std::string& shader_path);
+
+    GpuTerrainGenerator(const GpuTerrainGenerator&) = delete;
+    GpuTerrainGenerator& operator=(const GpuTerrainGenerator&) = delete;
+
+    // Overwrites every voxel, world_descriptor_sets match world_set_layouts
+    void record(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets,
+                glm::ivec3 world_dimensions, const generation::TerrainSettings& settings);
+
+private:
+    Device& device;
+    std::unique_ptr<Pipeline> generate_pipeline;
+};
+
+}
@@ -1,36 +1,210 @@
 #include <stdexcept>
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include "renderer.h"
 #include "math/random/rng.h"
+#include "graphics/upload/upload_manager.h"
+#include "graphics/generation/gpu_terrain_generator.h"
+#include "files/chunked_state.h"
 
 namespace cscd {
 
 Renderer::Renderer(Window& window_, Device& device_, SceneInfo& scene_info_, std::string state_path) :
-    window{window_},
+    window{&window_},
     device{device_},
     scene_info{scene_info_},
-    world_state{state_path},
     color_images{IMAGE_HISTORY_COUNT, VK_NULL_HANDLE},
     color_image_views{IMAGE_HISTORY_COUNT, VK_NULL_HANDLE}
 {
+    {
+        file::MappedState world_file{state_path};
+        loadWorld(world_file);
+    }
+    createWorldResources();
+}
+
+Renderer::Renderer(Window& window_, Device& device_, SceneInfo& scene_info_, file::WorldSource& world_source) :
+    window{&window_},
+    device{device_},
+    scene_info{scene_info_},
+    color_images{IMAGE_HISTORY_COUNT, VK_NULL_HANDLE},
+    color_image_views{IMAGE_HISTORY_COUNT, VK_NULL_HANDLE}
+{
+    loadWorld(world_source);
+    createWorldResources();
+}
+
+Renderer::Renderer(Window& window_, Device& device_, SceneInfo& scene_info_, file::State&& state) :
+    window{&window_},
+    device{device_},
+    scene_info{scene_info_},
+    color_images{IMAGE_HISTORY_COUNT, VK_NULL_HANDLE},
+    color_image_views{IMAGE_HISTORY_COUNT, VK_NULL_HANDLE}
+{
+    {
+        file::StateSource world_source{std::move(state)};
+        loadWorld(world_source);
+    }
+    createWorldResources();
+}
+
+Renderer::Renderer(Device& device_, SceneInfo& scene_info_, file::State&& state) :
+    window{nullptr},
+    device{device_},
+    scene_info{scene_info_},
+    color_images{IMAGE_HISTORY_COUNT, VK_NULL_HANDLE},
+    color_image_views{IMAGE_HISTORY_COUNT, VK_NULL_HANDLE}
+{
+    {
+        file::StateSource world_source{std::move(state)};
+        loadWorld(world_source);
+    }
+    createWorldResources();
+    createTimestampPool();
+}
+
+Renderer::Renderer(Window& window_, Device& device_, SceneInfo& scene_info_, glm::ivec3 world_dimensions_, const generation::TerrainSettings& terrain,
+                   bool stream) :
+    window{&window_},
+    device{device_},
+    scene_info{scene_info_},
+    color_images{IMAGE_HISTORY_COUNT, VK_NULL_HANDLE},
+    color_image_views{IMAGE_HISTORY_COUNT, VK_NULL_HANDLE}
+{
+    world_dimensions = world_dimensions_;
+    world_size = (VkDeviceSize)world_dimensions.x * world_dimensions.y * world_dimensions.z;
+    if (world_size == 0) {
+        throw std::runtime_error("World contains no voxels!");
+    }
+
+    createSamplers();
+    createStateBuffer();
+    createWorldResources();
+    if (stream) {
+        generation::TerrainGenerator generator{};
+        generator.settings = terrain;
+        int world_height = world_dimensions.y;
+        chunk_streamer = std::make_unique<ChunkStreamer>(device, scene_info, state_buffers, state_segment_layers,
+            [generator, world_height](glm::ivec3 origin, glm::ivec3 extent, uint8_t* voxels) mutable {
+                generator.generatePerlin2DRegion(voxels, origin, extent, world_height);
+            });
+        // The initial window is generated where the streamer centred it
+        updateSceneInfo();
+    }
+    generateTerrain(terrain);
+}
+
+void Renderer::loadWorld(file::WorldSource& world_source) {
+    world_dimensions = glm::ivec3(world_source.getDimensions());
+    world_size = world_source.getSize();
+    if (world_size == 0) {
+        throw std::runtime_error("World contains no voxels!");
+    }
+
     createSamplers();
     createStateBuffer();
-    uploadState();
+    uploadState(world_source);
+}
+
+void Renderer::createWorldResources() {
     createStateDescriptors();
     createSubchunkStateBuffer();
     createSubchunkStateDescriptors();
     createSceneInfoBuffer();
     createSceneInfoDescriptors();
-    recreateSwapchain();
-    createSceneInfo(swap_chain->getSwapChainExtent());
+    if (window) {
+        recreateSwapchain();
+        createSceneInfo(swap_chain->getSwapChainExtent());
+    } else {
+        createSceneInfo(VkExtent2D{0, 0});
+    }
     createPipelines();
     createCommandBuffers();
+    if (async_physics) {
+        createAsyncPhysics();
+    }
+
+    std::vector<VkDescriptorSetLayout> world_set_layouts = { state_set_layout->getDescriptorSetLayout(), scene_info_set_layout->getDescriptorSetLayout(), subchunk_state_set_layout->getDescriptorSetLayout() };
+    snapshot_manager = std::make_unique<SnapshotManager>(device, world_dimensions, scene_info.chunk_size, chunk_flags_buffer,
+                                                         world_set_layouts, shader_dir + "snapshot.comp.spv",
+                                                         renderer_settings.snapshot_directory);
+    edit_queue = std::make_unique<EditQueue>(device, world_set_layouts, shader_dir + "edit.comp.spv");
+    chunk_hasher = std::make_unique<ChunkHasher>(device, world_dimensions, scene_info.chunk_size, world_set_layouts, shader_dir + "hash.comp.spv");
+}
+
+void Renderer::generateTerrain(const generation::TerrainSettings& terrain) {
+    std::vector<VkDescriptorSetLayout> world_set_layouts = { state_set_layout->getDescriptorSetLayout(), scene_info_set_layout->getDescriptorSetLayout(), subchunk_state_set_layout->getDescriptorSetLayout() };
+    std::vector<VkDescriptorSet> world_descriptor_sets = { state_descriptor_set, scene_info_descriptor_set, subchunk_state_descriptor_set };
+    GpuTerrainGenerator generator{device, world_set_layouts, shader_dir + "generate.comp.spv"};
+
+    VkCommandBuffer command_buffer = beginSingleTimeCommands();
+    generator.record(command_buffer, world_descriptor_sets, world_dimensions, terrain);
+    endSingleTimeCommands(command_buffer);
+}
+
+void Renderer::downloadState(std::vector<uint8_t>& voxels) {
+    if (is_frame_started) {
+        throw std::runtime_error("Cannot download the world while a frame is in progress!");
+    }
+    vkQueueWaitIdle(device.computeQueue());
+    vkQueueWaitIdle(device.physicsQueue());
+
+    VkBufferCreateInfo buffer_create_info{};
+    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.size = world_size;
+    buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    VmaAllocationCreateInfo allocation_info{};
+    allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+    allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VkBuffer readback_buffer;
+    VmaAllocation readback_allocation;
+    VmaAllocationInfo readback_info;
+    if (vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &readback_buffer, &readback_allocation, &readback_info) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create world readback buffer!");
+    }
+
+    VkDeviceSize layer_size = (VkDeviceSize)world_dimensions.x * world_dimensions.y;
+    VkCommandBuffer command_buffer = beginSingleTimeCommands();
+    for (uint32_t i = 0; i < state_buffers.size(); i++) {
+        uint32_t segment_z = i * state_segment_layers;
+        VkBufferCopy copy_region{};
+        copy_region.srcOffset = 0;
+        copy_region.dstOffset = segment_z * layer_size;
+        copy_region.size = std::min<uint64_t>(state_segment_layers, world_dimensions.z - segment_z) * layer_size;
+        vkCmdCopyBuffer(command_buffer, state_buffers[i], readback_buffer, 1, &copy_region);
+    }
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+    endSingleTimeCommands(command_buffer);
+
+    vmaInvalidateAllocation(device.allocator(), readback_allocation, 0, VK_WHOLE_SIZE);
+    voxels.resize(world_size);
+    std::memcpy(voxels.data(), readback_info.pMappedData, world_size);
+    vmaDestroyBuffer(device.allocator(), readback_buffer, readback_allocation);
 }
 
 Renderer::~Renderer() {
+    chunk_streamer.reset();
+    snapshot_manager.reset();
+    edit_queue.reset();
+    chunk_hasher.reset();
     vkDestroySampler(device.device(), color_sampler, nullptr);
     vkDestroySampler(device.device(), normal_sampler, nullptr);
     vkDestroySampler(device.device(), position_sampler, nullptr);
@@ -39,15 +213,34 @@ Renderer::~Renderer() {
     }
     vkDestroyImageView(device.device(), normal_image_view, nullptr);
     vkDestroyImageView(device.device(), position_image_view, nullptr);
-    for (int i = 0; i < color_images.size(); i++) {
+    for (int i = 0; i < color_allocations.size(); i++) {
         vmaDestroyImage(device.allocator(), color_images[i], color_allocations[i]);
     }
     vmaDestroyImage(device.allocator(), normal_image, normal_allocation);
     vmaDestroyImage(device.allocator(), position_image, position_allocation);
     vmaDestroyBuffer(device.allocator(), subchunk_state_buffer, subchunk_state_allocation);
-    vmaDestroyBuffer(device.allocator(), state_buffer, state_allocation);
+    vmaDestroyBuffer(device.allocator(), chunk_flags_buffer, chunk_flags_allocation);
+    vmaDestroyBuffer(device.allocator(), chunk_activity_buffer, chunk_activity_allocation);
+    vmaDestroyBuffer(device.allocator(), active_cells_buffer, active_cells_allocation);
+    vmaDestroyBuffer(device.allocator(), counter_readback_buffer, counter_readback_allocation);
+    vkDestroyQueryPool(device.device(), timestamp_pool, nullptr);
+    for (size_t i = 0; i < state_buffers.size(); i++) {
+        vmaDestroyBuffer(device.allocator(), state_buffers[i], state_allocations[i]);
+        vmaDestroyBuffer(device.allocator(), occupancy_buffers[i], occupancy_allocations[i]);
+        if (async_physics) {
+            vmaDestroyBuffer(device.allocator(), front_state_buffers[i], front_state_allocations[i]);
+            vmaDestroyBuffer(device.allocator(), front_occupancy_buffers[i], front_occupancy_allocations[i]);
+        }
+    }
     vmaDestroyBuffer(device.allocator(), scene_info_buffer, scene_info_allocation);
     freeCommandBuffers();
+    if (async_physics) {
+        VkCommandBuffer physics_buffers[] = { physics_command_buffer, publish_command_buffer };
+        vkFreeCommandBuffers(device.device(), device.getPhysicsCommandPool(), 2, physics_buffers);
+        vkDestroyFence(device.device(), physics_fence, nullptr);
+        vkDestroySemaphore(device.device(), publish_semaphore, nullptr);
+        vkDestroySemaphore(device.device(), render_semaphore, nullptr);
+    }
 }
 
 void Renderer::createSamplers() {
@@ -75,25 +268,80 @@ void Renderer::createSamplers() {
 }
 
 void Renderer::createStateBuffer() {
-    VkBufferCreateInfo buffer_create_info{};
-    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    buffer_create_info.size = world_state.getSize();
-    buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    // Split the world into z-slabs that each fit in one storage buffer binding
+    VkDeviceSize layer_size = (VkDeviceSize)world_dimensions.x * world_dimensions.y;
+    VkDeviceSize max_segment_size = std::min<VkDeviceSize>(device.properties.limits.maxStorageBufferRange, STATE_MAX_SEGMENT_SIZE);
+    if (layer_size > max_segment_size) {
+        throw std::runtime_error("World layers are too large for a storage buffer!");
+    }
 
-    VmaAllocationCreateInfo allocation_info{};
-    allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
-    allocation_info.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-    allocation_info.priority = 1.0f;
+    state_segment_layers = std::min<VkDeviceSize>(max_segment_size / layer_size, world_dimensions.z);
+    // Keep whole chunks in a segment so each one is decoded once on upload
+    if (state_segment_layers > (uint32_t)scene_info.chunk_size) {
+        state_segment_layers -= state_segment_layers % scene_info.chunk_size;
+    }
+
+    uint32_t segment_count = (world_dimensions.z + state_segment_layers - 1) / state_segment_layers;
+    if (segment_count > MAX_STATE_SEGMENTS) {
+        throw std::runtime_error("World needs more state segments than the shaders support!");
+    }
+
+    state_buffers.resize(segment_count);
+    state_allocations.resize(segment_count);
+    occupancy_buffers.resize(segment_count);
+    occupancy_allocations.resize(segment_count);
+    // Only worth the second copy when physics can actually run alongside the raytracer
+    async_physics = window && device.hasAsyncCompute();
+    if (async_physics) {
+        front_state_buffers.resize(segment_count);
+        front_state_allocations.resize(segment_count);
+        front_occupancy_buffers.resize(segment_count);
+        front_occupancy_allocations.resize(segment_count);
+    }
+    VkDeviceSize occupancy_layer_size = (VkDeviceSize)((world_dimensions.x + 31) / 32) * world_dimensions.y * sizeof(uint32_t);
+    for (uint32_t i = 0; i < segment_count; i++) {
+        uint32_t layers = std::min<uint32_t>(state_segment_layers, world_dimensions.z - i * state_segment_layers);
+
+        VkBufferCreateInfo buffer_create_info{};
+        buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        buffer_create_info.size = layers * layer_size;
+        buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        device.setSharedQueueFamilies(buffer_create_info);
+
+        VmaAllocationCreateInfo allocation_info{};
+        allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+        allocation_info.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        allocation_info.priority = 1.0f;
+
+        if (vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &state_buffers[i], &state_allocations[i], nullptr) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate world state segment!");
+        }
+        // Published in full on the first frame, which wakes every chunk
+        if (async_physics && vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &front_state_buffers[i], &front_state_allocations[i], nullptr) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate front world state segment!");
+        }
 
-    vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &state_buffer, &state_allocation, nullptr);
+        // Filled from the state on the first frame
+        buffer_create_info.size = layers * occupancy_layer_size;
+        buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        if (vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &occupancy_buffers[i], &occupancy_allocations[i], nullptr) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate world occupancy segment!");
+        }
+        if (async_physics && vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &front_occupancy_buffers[i], &front_occupancy_allocations[i], nullptr) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate front world occupancy segment!");
+        }
+    }
 }
 
 void Renderer::createSubchunkStateBuffer() {
     int subchunk_size = scene_info.chunk_size / 2;
+    glm::ivec3 num_subchunks = (world_dimensions + subchunk_size - 1) / subchunk_size;
     VkBufferCreateInfo buffer_create_info{};
     buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    buffer_create_info.size = world_state.getSize() / (subchunk_size * subchunk_size * subchunk_size);
+    buffer_create_info.size = (VkDeviceSize)num_subchunks.x * num_subchunks.y * num_subchunks.z;
     buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    // Cleared on the compute queue, then used by physics
+    device.setSharedQueueFamilies(buffer_create_info);
 
     VmaAllocationCreateInfo allocation_info{};
     allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
@@ -101,33 +349,71 @@ void Renderer::createSubchunkStateBuffer() {
     allocation_info.priority = 1.0f;
 
     vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &subchunk_state_buffer, &subchunk_state_allocation, nullptr);
-}
-
-void Renderer::uploadState() {
-    VkBuffer staging_buffer;
-    VmaAllocation staging_allocation;
-
-    VkBufferCreateInfo buffer_create_info{};
-    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    buffer_create_info.size = world_state.getSize();
-    buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-
-    VmaAllocationCreateInfo allocation_info{};
-    allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
-    allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
-    allocation_info.priority = 1.0f;
 
-    VmaAllocationInfo alloc_info;
+    // One word of flags per chunk, physics marks the chunks it writes to
+    file::ChunkGrid chunk_grid{glm::uvec3(world_dimensions), (uint32_t)scene_info.chunk_size};
+    buffer_create_info.size = chunk_grid.chunkCount() * sizeof(uint32_t);
+    buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 
-    vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &staging_buffer, &staging_allocation, &alloc_info);
+    vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &chunk_flags_buffer, &chunk_flags_allocation, nullptr);
+    fillBuffer(chunk_flags_buffer, buffer_create_info.size, 0);
 
-    memcpy(alloc_info.pMappedData, world_state.data.data(), (size_t)world_state.getSize());
-    copyBuffer(staging_buffer, state_buffer, world_state.getSize());
+    // Filled on the first frame, which wakes every chunk
+    buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &chunk_activity_buffer, &chunk_activity_allocation, nullptr);
+
+    // A physics cell per chunk plus one more along each axis, the randomly
+    // offset subchunks of the last cell reach back into the world
+    glm::uvec3 cell_counts = chunk_grid.counts + 1u;
+    physics_cell_count = cell_counts.x * cell_counts.y * cell_counts.z;
+    buffer_create_info.size = ACTIVE_CELLS_COUNTERS_OFFSET + sizeof(PhysicsCounters) + (VkDeviceSize)physics_cell_count * sizeof(uint32_t);
+    buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &active_cells_buffer, &active_cells_allocation, nullptr);
+
+    VmaAllocationCreateInfo readback_allocation_info{};
+    readback_allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+    readback_allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    buffer_create_info.size = sizeof(PhysicsCounters);
+    buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_create_info.queueFamilyIndexCount = 0;
+    buffer_create_info.pQueueFamilyIndices = nullptr;
+    vmaCreateBuffer(device.allocator(), &buffer_create_info, &readback_allocation_info, &counter_readback_buffer, &counter_readback_allocation, &counter_readback_info);
+    std::memset(counter_readback_info.pMappedData, 0, sizeof(PhysicsCounters));
+}
 
-    vmaDestroyBuffer(device.allocator(), staging_buffer, staging_allocation);
+void Renderer::uploadState(file::WorldSource& world_source) {
+    uint64_t layer_size = world_source.getLayerSize();
+    // Whole decode units per slice, the staging ring grows to fit one when it's larger
+    uint64_t granularity = layer_size * world_source.getPreferredLayerBatch();
+
+    int reported_percent = 0;
+    UploadManager upload_manager{device};
+    for (uint32_t i = 0; i < state_buffers.size(); i++) {
+        uint32_t segment_z = i * state_segment_layers;
+        uint64_t segment_size = std::min<uint64_t>(state_segment_layers, world_dimensions.z - segment_z) * layer_size;
+        uint64_t segment_offset = segment_z * layer_size;
+
+        upload_manager.upload(state_buffers[i], 0, segment_size, granularity,
+            [&](uint64_t offset, uint64_t size, uint8_t* dst) {
+                uint32_t z_begin = segment_z + offset / layer_size;
+                uint32_t z_count = size / layer_size;
+                // Get the disk started on the next slice while this one is decoded and copied
+                world_source.prefetchLayers(z_begin + z_count, z_count);
+                world_source.decodeLayers(z_begin, z_count, dst);
+            },
+            [&](uint64_t completed, uint64_t total) {
+                int percent = (int)(((segment_offset + completed) * 100) / world_size);
+                if (percent / 10 > reported_percent / 10 || segment_offset + completed == world_size) {
+                    reported_percent = percent;
+                    std::cout << "Uploading world: " << percent << "%" << std::endl;
+                }
+            });
+    }
 }
 
-void Renderer::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size) {
+VkCommandBuffer Renderer::beginSingleTimeCommands() {
     VkCommandBufferAllocateInfo alloc_info{};
     alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
@@ -144,13 +430,10 @@ void Renderer::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize
     begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
     vkBeginCommandBuffer(command_buffer, &begin_info);
+    return command_buffer;
+}
 
-    VkBufferCopy copy_region{};
-    copy_region.srcOffset = 0;
-    copy_region.dstOffset = 0;
-    copy_region.size = size;
-    vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_region);
-
+void Renderer::endSingleTimeCommands(VkCommandBuffer command_buffer) {
     vkEndCommandBuffer(command_buffer);
 
     VkSubmitInfo submit_info{};
@@ -163,34 +446,81 @@ void Renderer::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize
     vkFreeCommandBuffers(device.device(), device.getCommandPool(), 1, &command_buffer);
 }
 
+void Renderer::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size) {
+    VkCommandBuffer command_buffer = beginSingleTimeCommands();
+
+    VkBufferCopy copy_region{};
+    copy_region.srcOffset = 0;
+    copy_region.dstOffset = 0;
+    copy_region.size = size;
+    vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_region);
+
+    endSingleTimeCommands(command_buffer);
+}
+
+void Renderer::fillBuffer(VkBuffer dst_buffer, VkDeviceSize size, uint32_t value) {
+    VkCommandBuffer command_buffer = beginSingleTimeCommands();
+    vkCmdFillBuffer(command_buffer, dst_buffer, 0, size, value);
+    endSingleTimeCommands(command_buffer);
+}
+
 void Renderer::createStateDescriptors() {
     state_set_layout = DescriptorSetLayout::Builder(device)
-    .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+    .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, MAX_STATE_SEGMENTS)
+    .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, MAX_STATE_SEGMENTS)
     .build();
 
     state_pool = DescriptorPool::Builder(device)
-    .setMaxSets(1)
-    .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
+    .setMaxSets(2)
+    .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * MAX_STATE_SEGMENTS)
     .build();
 
-    VkDescriptorBufferInfo buffer_info{};
-    buffer_info.buffer = state_buffer;
-    buffer_info.offset = 0;
-    buffer_info.range = VK_WHOLE_SIZE;
+    // Unused slots repeat the last segment so every descriptor in the array is valid
+    std::array<VkDescriptorBufferInfo, MAX_STATE_SEGMENTS> buffer_infos{};
+    std::array<VkDescriptorBufferInfo, MAX_STATE_SEGMENTS> occupancy_infos{};
+    for (uint32_t i = 0; i < MAX_STATE_SEGMENTS; i++) {
+        size_t segment = std::min<size_t>(i, state_buffers.size() - 1);
+        buffer_infos[i].buffer = state_buffers[segment];
+        buffer_infos[i].offset = 0;
+        buffer_infos[i].range = VK_WHOLE_SIZE;
+        occupancy_infos[i].buffer = occupancy_buffers[segment];
+        occupancy_infos[i].offset = 0;
+        occupancy_infos[i].range = VK_WHOLE_SIZE;
+    }
 
     DescriptorWriter(*state_set_layout, *state_pool)
-    .writeBuffer(0, &buffer_info)
+    .writeBuffers(0, buffer_infos.data(), MAX_STATE_SEGMENTS)
+    .writeBuffers(1, occupancy_infos.data(), MAX_STATE_SEGMENTS)
     .build(state_descriptor_set);
+
+    if (!async_physics) {
+        front_state_descriptor_set = state_descriptor_set;
+        return;
+    }
+
+    for (uint32_t i = 0; i < MAX_STATE_SEGMENTS; i++) {
+        size_t segment = std::min<size_t>(i, state_buffers.size() - 1);
+        buffer_infos[i].buffer = front_state_buffers[segment];
+        occupancy_infos[i].buffer = front_occupancy_buffers[segment];
+    }
+
+    DescriptorWriter(*state_set_layout, *state_pool)
+    .writeBuffers(0, buffer_infos.data(), MAX_STATE_SEGMENTS)
+    .writeBuffers(1, occupancy_infos.data(), MAX_STATE_SEGMENTS)
+    .build(front_state_descriptor_set);
 }
 
 void Renderer::createSubchunkStateDescriptors() {
     subchunk_state_set_layout = DescriptorSetLayout::Builder(device)
     .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+    .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+    .addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+    .addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
     .build();
 
     subchunk_state_pool = DescriptorPool::Builder(device)
     .setMaxSets(1)
-    .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
+    .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4)
     .build();
 
     VkDescriptorBufferInfo buffer_info{};
@@ -198,8 +528,26 @@ void Renderer::createSubchunkStateDescriptors() {
     buffer_info.offset = 0;
     buffer_info.range = VK_WHOLE_SIZE;
 
+    VkDescriptorBufferInfo flags_info{};
+    flags_info.buffer = chunk_flags_buffer;
+    flags_info.offset = 0;
+    flags_info.range = VK_WHOLE_SIZE;
+
+    VkDescriptorBufferInfo activity_info{};
+    activity_info.buffer = chunk_activity_buffer;
+    activity_info.offset = 0;
+    activity_info.range = VK_WHOLE_SIZE;
+
+    VkDescriptorBufferInfo active_cells_info{};
+    active_cells_info.buffer = active_cells_buffer;
+    active_cells_info.offset = 0;
+    active_cells_info.range = VK_WHOLE_SIZE;
+
     DescriptorWriter(*subchunk_state_set_layout, *subchunk_state_pool)
     .writeBuffer(0, &buffer_info)
+    .writeBuffer(1, &flags_info)
+    .writeBuffer(2, &activity_info)
+    .writeBuffer(3, &active_cells_info)
     .build(subchunk_state_descriptor_set);
 }
 
@@ -208,6 +556,7 @@ void Renderer::createSceneInfoBuffer() {
     buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     buffer_create_info.size = sizeof(SceneInfo);
     buffer_create_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    device.setSharedQueueFamilies(buffer_create_info);
 
     VmaAllocationCreateInfo allocation_info{};
     allocation_info.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
@@ -238,9 +587,9 @@ void Renderer::createSceneInfoDescriptors() {
 }
 
 void Renderer::createSceneInfo(VkExtent2D extent) {
-    glm::ivec3 world_dimensions = world_state.getDimensions();
     scene_info.screen_dimensions = glm::ivec2{extent.width, extent.height};
     scene_info.world_dimensions = world_dimensions;
+    scene_info.state_segment_layers = state_segment_layers;
     scene_info.camera_position = glm::vec3{world_dimensions.x / 2, world_dimensions.y / 2, -12.0f};
     scene_info.camera_direction = glm::vec3{0.0, 0.0, 1.0};
     scene_info.old_camera_position = scene_info.camera_position;
@@ -343,9 +692,9 @@ void Renderer::recreateDenoiseImages(VkExtent2D extent) {
 }
 
 void Renderer::recreateSwapchain() {
-    auto extent = window.getExtent();
+    auto extent = window->getExtent();
     while (extent.width == 0 || extent.height == 0) {
-        extent = window.getExtent();
+        extent = window->getExtent();
         glfwWaitEvents();
     }
 
@@ -452,6 +801,60 @@ void Renderer::createPipelines() {
 
     std::vector<VkDescriptorSetLayout> physics_set_layouts = { state_set_layout->getDescriptorSetLayout(), scene_info_set_layout->getDescriptorSetLayout(), subchunk_state_set_layout->getDescriptorSetLayout() };
     physics_pipeline = std::make_unique<Pipeline>(device, shader_dir + "physics.comp.spv", physics_set_layouts, subc_push_const_ranges);
+    if (device.properties.limits.maxComputeSharedMemorySize >= PHYSICS_TILED_SHARED_SIZE) {
+        physics_tiled_pipeline = std::make_unique<Pipeline>(device, shader_dir + "physics_tiled.comp.spv", physics_set_layouts, subc_push_const_ranges);
+    }
+    // A subgroup's ballot has to stay within one cell's row of blocks
+    const VkPhysicalDeviceSubgroupProperties& subgroups = device.subgroup_properties;
+    if ((subgroups.supportedOperations & VK_SUBGROUP_FEATURE_BALLOT_BIT) && (subgroups.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+        subgroups.subgroupSize <= 64 && device.properties.limits.maxComputeWorkGroupInvocations >= PHYSICS_FINE_INVOCATIONS) {
+        physics_fine_pipeline = std::make_unique<Pipeline>(device, shader_dir + "physics_fine.comp.spv", physics_set_layouts, subc_push_const_ranges);
+    }
+
+    // Create active cell compaction pipeline
+    VkPushConstantRange compact_push_const_range{};
+    compact_push_const_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    compact_push_const_range.offset = 0;
+    compact_push_const_range.size = sizeof(CompactPushConstant);
+    std::vector<VkPushConstantRange> compact_push_const_ranges = { compact_push_const_range };
+
+    compact_pipeline = std::make_unique<Pipeline>(device, shader_dir + "compact.comp.spv", physics_set_layouts, compact_push_const_ranges);
+
+    // Create occupancy rebuild pipeline
+    std::vector<VkDescriptorSetLayout> occupancy_set_layouts = { state_set_layout->getDescriptorSetLayout(), scene_info_set_layout->getDescriptorSetLayout() };
+    VkPushConstantRange occupancy_push_const_range{};
+    occupancy_push_const_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    occupancy_push_const_range.offset = 0;
+    occupancy_push_const_range.size = sizeof(OccupancyPushConstant);
+    std::vector<VkPushConstantRange> occupancy_push_const_ranges = { occupancy_push_const_range };
+    occupancy_pipeline = std::make_unique<Pipeline>(device, shader_dir + "occupancy.comp.spv", occupancy_set_layouts, occupancy_push_const_ranges);
+
+    // Create Margolus physics pipeline
+    VkPushConstantRange margolus_push_const_range{};
+    margolus_push_const_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    margolus_push_const_range.offset = 0;
+    margolus_push_const_range.size = sizeof(MargolusPushConstant);
+    std::vector<VkPushConstantRange> margolus_push_const_ranges = { margolus_push_const_range };
+
+    margolus_pipeline = std::make_unique<Pipeline>(device, shader_dir + "margolus.comp.spv", physics_set_layouts, margolus_push_const_ranges);
+
+    // Create front state publish pipeline
+    if (async_physics) {
+        VkPushConstantRange publish_push_const_range{};
+        publish_push_const_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        publish_push_const_range.offset = 0;
+        publish_push_const_range.size = sizeof(PublishPushConstant);
+        std::vector<VkPushConstantRange> publish_push_const_ranges = { publish_push_const_range };
+
+        std::vector<VkDescriptorSetLayout> publish_set_layouts = physics_set_layouts;
+        publish_set_layouts.push_back(state_set_layout->getDescriptorSetLayout());
+        publish_pipeline = std::make_unique<Pipeline>(device, shader_dir + "publish.comp.spv", publish_set_layouts, publish_push_const_ranges);
+    }
+
+    // Headless renderers only simulate
+    if (!window) {
+        return;
+    }
 
     // Create graphics pipeline
     VkPushConstantRange rt_push_const_range{};
@@ -488,6 +891,34 @@ void Renderer::createCommandBuffers() {
     }
 }
 
+void Renderer::createAsyncPhysics() {
+    VkCommandBufferAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandPool = device.getPhysicsCommandPool();
+    alloc_info.commandBufferCount = 2;
+
+    VkCommandBuffer physics_buffers[2];
+    if (vkAllocateCommandBuffers(device.device(), &alloc_info, physics_buffers) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate physics command buffers!");
+    }
+    physics_command_buffer = physics_buffers[0];
+    publish_command_buffer = physics_buffers[1];
+
+    VkSemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    VkFenceCreateInfo fence_info{};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    if (vkCreateSemaphore(device.device(), &semaphore_info, nullptr, &publish_semaphore) != VK_SUCCESS ||
+        vkCreateSemaphore(device.device(), &semaphore_info, nullptr, &render_semaphore) != VK_SUCCESS ||
+        vkCreateFence(device.device(), &fence_info, nullptr, &physics_fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create physics synchronization objects!");
+    }
+}
+
 void Renderer::freeCommandBuffers() {
     vkFreeCommandBuffers(device.device(), device.getCommandPool(), static_cast<uint32_t>(command_buffers.size()), command_buffers.data());
     command_buffers.clear();
@@ -498,6 +929,11 @@ VkCommandBuffer Renderer::beginFrame() {
         throw std::runtime_error("Can't call beginFrame while frame already in progress");
     }
 
+    // The host reads back what physics wrote last frame once this returns
+    if (async_physics) {
+        vkWaitForFences(device.device(), 1, &physics_fence, VK_TRUE, UINT64_MAX);
+    }
+
     render_settings.frame_num++;
 
     if (reset_accumulation) {
@@ -575,10 +1011,19 @@ void Renderer::endFrame() {
         throw std::runtime_error("failed to record command buffer!");
     }
 
-    auto result = swap_chain->submitCommandBuffers(&command_buffer, &submit_image_index);
+    // Wait for a front copy published since the last render, and hold this
+    // frame's publish back until the raytracer is done with the old one
+    VkSemaphore wait_semaphore = publish_signalled ? publish_semaphore : VK_NULL_HANDLE;
+    VkSemaphore signal_semaphore = publish_pending ? render_semaphore : VK_NULL_HANDLE;
+    publish_signalled = false;
+    auto result = swap_chain->submitCommandBuffers(&command_buffer, &submit_image_index, wait_semaphore, signal_semaphore);
+    if (publish_pending) {
+        submitPublish(render_semaphore);
+        publish_pending = false;
+    }
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || window.wasWindowResized()) {
-        window.resetWindowResizedFlag();
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || window->wasWindowResized()) {
+        window->resetWindowResizedFlag();
         recreateSwapchain();
     } else if (result != VK_SUCCESS) {
         throw std::runtime_error("failed to present swap chain image!");
@@ -588,27 +1033,148 @@ void Renderer::endFrame() {
     curr_frame_index = 0;
 }
 
-void Renderer::render() {
-    updateSceneInfo();
+void Renderer::resetActiveCells(VkCommandBuffer command_buffer) {
+    // The previous tick's dispatches must be done reading the list before it is cleared
+    VkMemoryBarrier2 clear_barrier{};
+    clear_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    clear_barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR;
+    clear_barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
+
+    VkDependencyInfoKHR clear_dep_info{};
+    clear_dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    clear_dep_info.memoryBarrierCount = 1;
+    clear_dep_info.pMemoryBarriers = &clear_barrier;
+    vkCmdPipelineBarrier2(command_buffer, &clear_dep_info);
+
+    // Empty list, dispatched as (0, 1, 1) and (0, PHYSICS_LOCAL_SIZE, 1) workgroups until compaction adds some
+    uint32_t header[10] = { 0, 1, 1, 0, PHYSICS_LOCAL_SIZE, 1, 0, 0, 0, 0 };
+    vkCmdUpdateBuffer(command_buffer, active_cells_buffer, 0, sizeof(header), header);
+    if (wake_all_chunks) {
+        vkCmdFillBuffer(command_buffer, chunk_activity_buffer, 0, VK_WHOLE_SIZE, physics_frame);
+        wake_all_chunks = false;
+    }
+    // A streamed chunk's voxels were all replaced. Its flags are reset to dirty,
+    // compaction sets CHUNK_FLAG_AWAKE again and counts it as woken.
+    glm::ivec3 num_chunks = (world_dimensions + scene_info.chunk_size - 1) / scene_info.chunk_size;
+    for (glm::ivec2 column : streamed_columns) {
+        for (int y = 0; y < num_chunks.y; y++) {
+            VkDeviceSize offset = ((VkDeviceSize)(column.y * num_chunks.y + y) * num_chunks.x + column.x) * sizeof(uint32_t);
+            vkCmdFillBuffer(command_buffer, chunk_activity_buffer, offset, sizeof(uint32_t), physics_frame);
+            vkCmdFillBuffer(command_buffer, chunk_flags_buffer, offset, sizeof(uint32_t), CHUNK_FLAG_DIRTY);
+        }
+    }
+    streamed_columns.clear();
 
-    auto command_buffer = getCurrentCommandBuffer();
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT_KHR | VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
 
-    /*  Create physics structures */
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, physics_pipeline->getPipeline());
-    std::vector<VkDescriptorSet> physics_descriptor_sets;
-    physics_descriptor_sets.push_back(state_descriptor_set);
-    physics_descriptor_sets.push_back(scene_info_descriptor_set);
-    physics_descriptor_sets.push_back(subchunk_state_descriptor_set);
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, physics_pipeline->getPipelineLayout(), 0, physics_descriptor_sets.size(), physics_descriptor_sets.data(), 0, nullptr);
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+}
+
+void Renderer::recordActiveCells(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& physics_descriptor_sets) {
+    CompactPushConstant compact_settings{};
+    compact_settings.frame = physics_frame;
+    compact_settings.idle_frames = std::max(renderer_settings.physics_idle_frames, 1);
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, compact_pipeline->getPipeline());
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, compact_pipeline->getPipelineLayout(), 0, physics_descriptor_sets.size(), physics_descriptor_sets.data(), 0, nullptr);
+    vkCmdPushConstants(command_buffer, compact_pipeline->getPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CompactPushConstant), &compact_settings);
+    vkCmdDispatch(command_buffer, (physics_cell_count + PHYSICS_LOCAL_SIZE - 1) / PHYSICS_LOCAL_SIZE, 1, 1);
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR | VK_ACCESS_2_SHADER_READ_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+}
 
-    if (world_state.x_size != world_state.y_size || world_state.x_size != world_state.z_size || world_state.y_size != world_state.z_size) {
-        throw std::runtime_error("only worlds with square dimensions are supported!");
+void Renderer::recordOccupancyRebuild(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& physics_descriptor_sets) {
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, occupancy_pipeline->getPipeline());
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, occupancy_pipeline->getPipelineLayout(), 0, 2, physics_descriptor_sets.data(), 0, nullptr);
+    // A word of 32 voxels per invocation
+    auto dispatch_words = [&](glm::ivec3 first, glm::ivec3 count) {
+        OccupancyPushConstant occupancy_settings{};
+        occupancy_settings.first = first;
+        occupancy_settings.count = count;
+        vkCmdPushConstants(command_buffer, occupancy_pipeline->getPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(OccupancyPushConstant), &occupancy_settings);
+        vkCmdDispatch(command_buffer, (count.x + 7) / 8, (count.y + 7) / 8, count.z);
+    };
+    if (rebuild_occupancy) {
+        int row_words = (world_dimensions.x + 31) / 32;
+        dispatch_words(glm::ivec3(0), glm::ivec3(row_words, world_dimensions.y, world_dimensions.z));
+    } else {
+        // Just the words over each streamed column, words it shares with a neighbour are rebuilt whole
+        int chunk_size = scene_info.chunk_size;
+        for (glm::ivec2 column : streamed_columns) {
+            glm::ivec2 storage = column * chunk_size;
+            int first_word = storage.x / 32;
+            int last_word = (storage.x + chunk_size - 1) / 32;
+            dispatch_words(glm::ivec3(first_word, 0, storage.y), glm::ivec3(last_word - first_word + 1, world_dimensions.y, chunk_size));
+        }
     }
-    int group_count_x = (world_state.x_size / (scene_info.chunk_size * scene_info.local_size)) + 1;
-    int group_count_y = (world_state.y_size / (scene_info.chunk_size * scene_info.local_size)) + 1;
-    int group_count_z = (world_state.z_size / (scene_info.chunk_size * scene_info.local_size)) + 1;
+    rebuild_occupancy = false;
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT_KHR | VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+}
+
+void Renderer::recordCounterReadback(VkCommandBuffer command_buffer) {
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+
+    VkBufferCopy copy_region{};
+    copy_region.srcOffset = ACTIVE_CELLS_COUNTERS_OFFSET;
+    copy_region.size = sizeof(PhysicsCounters);
+    vkCmdCopyBuffer(command_buffer, active_cells_buffer, counter_readback_buffer, 1, &copy_region);
+
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT_KHR;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+}
+
+void Renderer::recordSubchunkPasses(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& physics_descriptor_sets) {
+    Pipeline* evolve_pipeline = getPhysicsPipeline();
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, evolve_pipeline->getPipeline());
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, evolve_pipeline->getPipelineLayout(), 0, physics_descriptor_sets.size(), physics_descriptor_sets.data(), 0, nullptr);
+    physics_settings.frame = physics_frame;
 
-    /*  Create barrier structures   */
     VkMemoryBarrier2 barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
     barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
@@ -616,7 +1182,6 @@ void Renderer::render() {
     barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
     barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT_KHR;
 
-    /*  Evolve physical system  */
     VkDependencyInfoKHR dep_info{};
     dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
     dep_info.memoryBarrierCount = 1;
@@ -653,10 +1218,294 @@ void Renderer::render() {
         int rand_offset = Rand::range(0, scene_info.chunk_size - 1);
         physics_settings.subchunk_offset = (physics_settings.subchunk_location * subchunk_size) - glm::ivec3(rand_offset, rand_offset, rand_offset);
 
-        vkCmdPushConstants(command_buffer, physics_pipeline->getPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PhysicsPushConstant), &physics_settings);
-        vkCmdDispatch(command_buffer, group_count_x, group_count_y, group_count_z);
+        vkCmdPushConstants(command_buffer, evolve_pipeline->getPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PhysicsPushConstant), &physics_settings);
+        vkCmdDispatchIndirect(command_buffer, active_cells_buffer, 0);
+        recordTimestamp(command_buffer, 2 + i);
         vkCmdPipelineBarrier2(command_buffer, &dep_info);
     }
+}
+
+// Two race free steps over Margolus blocks, the second with the blocks shifted
+// by a voxel along every axis. No random offsets, so a step is deterministic.
+void Renderer::recordMargolusSteps(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& physics_descriptor_sets) {
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, margolus_pipeline->getPipeline());
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, margolus_pipeline->getPipelineLayout(), 0, physics_descriptor_sets.size(), physics_descriptor_sets.data(), 0, nullptr);
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+
+    MargolusPushConstant margolus_settings{};
+    margolus_settings.frame = physics_frame;
+    for (int i = 0; i < 2; i++) {
+        margolus_settings.block_offset = i;
+        vkCmdPushConstants(command_buffer, margolus_pipeline->getPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MargolusPushConstant), &margolus_settings);
+        vkCmdDispatchIndirect(command_buffer, active_cells_buffer, ACTIVE_CELLS_CELL_DISPATCH_OFFSET);
+        recordTimestamp(command_buffer, 2 + i);
+        vkCmdPipelineBarrier2(command_buffer, &dep_info);
+    }
+}
+
+void Renderer::createTimestampPool() {
+    // The physics queue is a compute queue, which this covers
+    if (!device.properties.limits.timestampComputeAndGraphics) {
+        std::cout << "Device can't time compute work, skipping pass timings" << std::endl;
+        return;
+    }
+
+    VkQueryPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    pool_info.queryCount = PHYSICS_TIMESTAMP_COUNT;
+    if (vkCreateQueryPool(device.device(), &pool_info, nullptr, &timestamp_pool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create timestamp query pool!");
+    }
+}
+
+// Written once the commands before it have finished their compute work
+void Renderer::recordTimestamp(VkCommandBuffer command_buffer, uint32_t query) {
+    if (timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp2(command_buffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, timestamp_pool, query);
+    }
+}
+
+Pipeline* Renderer::getPhysicsPipeline() {
+    switch (renderer_settings.physics_kernel) {
+        case PhysicsKernel::TILED:
+            if (physics_tiled_pipeline) {
+                return physics_tiled_pipeline.get();
+            }
+            break;
+        case PhysicsKernel::FINE:
+            if (physics_fine_pipeline) {
+                return physics_fine_pipeline.get();
+            }
+            break;
+        default:
+            break;
+    }
+    return physics_pipeline.get();
+}
+
+int Renderer::physicsSubsteps(float frame_time) {
+    if (renderer_settings.physics_rate <= 0.0f) {
+        return 1;
+    }
+
+    float tick = 1.0f / renderer_settings.physics_rate;
+    int max_substeps = std::max(renderer_settings.max_physics_substeps, 1);
+    physics_accumulator += frame_time;
+    int substeps = static_cast<int>(physics_accumulator / tick);
+    if (substeps > max_substeps) {
+        // Too slow to keep up, let the simulation lag instead of taking longer every frame
+        substeps = max_substeps;
+        physics_accumulator = 0.0f;
+    } else {
+        physics_accumulator -= substeps * tick;
+    }
+    return substeps;
+}
+
+void Renderer::submitPhysics(uint32_t publish_from, std::vector<VkDescriptorSet>& physics_descriptor_sets) {
+    if (vkEndCommandBuffer(physics_command_buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record physics command buffer!");
+    }
+
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &physics_command_buffer;
+    if (vkQueueSubmit(device.physicsQueue(), 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit physics command buffer!");
+    }
+
+    /*  Copy the chunks written this frame into the front state  */
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(publish_command_buffer, &begin_info) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording publish command buffer!");
+    }
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR | VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(publish_command_buffer, &dep_info);
+
+    std::vector<VkDescriptorSet> publish_descriptor_sets = physics_descriptor_sets;
+    publish_descriptor_sets.push_back(front_state_descriptor_set);
+    vkCmdBindPipeline(publish_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, publish_pipeline->getPipeline());
+    vkCmdBindDescriptorSets(publish_command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, publish_pipeline->getPipelineLayout(), 0, publish_descriptor_sets.size(), publish_descriptor_sets.data(), 0, nullptr);
+
+    PublishPushConstant publish_settings{};
+    publish_settings.publish_from = publish_from;
+    vkCmdPushConstants(publish_command_buffer, publish_pipeline->getPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PublishPushConstant), &publish_settings);
+    glm::ivec3 num_chunks = (world_dimensions + scene_info.chunk_size - 1) / scene_info.chunk_size;
+    vkCmdDispatch(publish_command_buffer, num_chunks.x, num_chunks.y, num_chunks.z);
+
+    if (vkEndCommandBuffer(publish_command_buffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record publish command buffer!");
+    }
+
+    // Nothing has read the front copy yet on the first frame, so it can go straight away
+    if (!front_published) {
+        submitPublish(VK_NULL_HANDLE);
+        front_published = true;
+    } else {
+        publish_pending = true;
+    }
+}
+
+void Renderer::submitPublish(VkSemaphore wait_semaphore) {
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.waitSemaphoreCount = wait_semaphore != VK_NULL_HANDLE ? 1 : 0;
+    submit_info.pWaitSemaphores = &wait_semaphore;
+    submit_info.pWaitDstStageMask = &wait_stage;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &publish_command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &publish_semaphore;
+
+    vkResetFences(device.device(), 1, &physics_fence);
+    if (vkQueueSubmit(device.physicsQueue(), 1, &submit_info, physics_fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit publish command buffer!");
+    }
+    publish_signalled = true;
+}
+
+void Renderer::render(float frame_time) {
+    // The world holds still while a snapshot is still being gathered
+    bool world_frozen = snapshot_manager->isGathering();
+
+    if (chunk_streamer && !world_frozen && chunk_streamer->update()) {
+        // Last frame's positions are relative to the old window
+        render_settings.invalidate_accumulation = true;
+        reset_accumulation = true;
+    }
+    updateSceneInfo();
+
+    auto command_buffer = getCurrentCommandBuffer();
+
+    // Async physics records the simulation for the physics queue instead
+    VkCommandBuffer physics_commands = command_buffer;
+    if (async_physics) {
+        physics_commands = physics_command_buffer;
+
+        VkCommandBufferBeginInfo begin_info{};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if (vkBeginCommandBuffer(physics_commands, &begin_info) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to begin recording physics command buffer!");
+        }
+
+        // Last frame's publish reads the state this frame's physics writes
+        VkMemoryBarrier2 publish_barrier{};
+        publish_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+        publish_barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+        publish_barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+
+        VkDependencyInfoKHR publish_dep_info{};
+        publish_dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+        publish_dep_info.memoryBarrierCount = 1;
+        publish_dep_info.pMemoryBarriers = &publish_barrier;
+        vkCmdPipelineBarrier2(physics_commands, &publish_dep_info);
+    }
+
+    /*  Create physics structures */
+    std::vector<VkDescriptorSet> physics_descriptor_sets;
+    physics_descriptor_sets.push_back(state_descriptor_set);
+    physics_descriptor_sets.push_back(scene_info_descriptor_set);
+    physics_descriptor_sets.push_back(subchunk_state_descriptor_set);
+
+    /*  Upload chunks streamed in since the last frame  */
+    if (chunk_streamer && !world_frozen) {
+        chunk_streamer->record(physics_commands, streamed_columns);
+    }
+
+    // Only one frame is ever in flight, so last frame's counters have landed
+    vmaInvalidateAllocation(device.allocator(), counter_readback_allocation, 0, VK_WHOLE_SIZE);
+    std::memcpy(&physics_counters, counter_readback_info.pMappedData, sizeof(PhysicsCounters));
+
+    // Everything written from here on is stamped with this frame or later
+    uint32_t publish_from = physics_frame;
+
+    /*  Rebuild the occupancy of the whole world if asked to, otherwise of the streamed columns  */
+    if (rebuild_occupancy || !streamed_columns.empty()) {
+        recordOccupancyRebuild(physics_commands, physics_descriptor_sets);
+    }
+
+    /*  Clear the active cell list and wake chunks if asked to, streamed ones included */
+    resetActiveCells(physics_commands);
+
+    /*  Gather chunks for a pending snapshot   */
+    snapshot_manager->recordGather(physics_commands, physics_descriptor_sets);
+    // Gathered before physics, so the world may move on in the frame the last batch is recorded
+    world_frozen = snapshot_manager->isGathering();
+
+    /*  Apply edits made since the last frame, they wait while the world is frozen  */
+    if (!world_frozen) {
+        edit_queue->record(physics_commands, physics_descriptor_sets, physics_frame);
+    }
+
+    /*  Evolve physical system, one fixed tick per substep  */
+    int substeps = world_frozen ? 0 : physicsSubsteps(frame_time);
+    for (int i = 0; i < substeps; i++) {
+        if (i > 0) {
+            resetActiveCells(physics_commands);
+        }
+
+        /*  List the cells with anything left to move, edits have already woken theirs  */
+        recordActiveCells(physics_commands, physics_descriptor_sets);
+
+        if (renderer_settings.physics_kernel == PhysicsKernel::MARGOLUS) {
+            recordMargolusSteps(physics_commands, physics_descriptor_sets);
+        } else {
+            recordSubchunkPasses(physics_commands, physics_descriptor_sets);
+        }
+        physics_frame++;
+    }
+    if (substeps > 0) {
+        recordCounterReadback(physics_commands);
+    }
+
+    chunk_hasher->record(physics_commands, physics_descriptor_sets);
+    snapshot_manager->recordFlagReadback(physics_commands);
+
+    /*  Hand this frame's physics to the physics queue, the raytracer carries on with the front copy  */
+    if (async_physics) {
+        submitPhysics(publish_from, physics_descriptor_sets);
+    }
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
 
     /*  Render world state to image    */
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, graphics_pipeline->getPipeline());
@@ -665,15 +1514,15 @@ void Renderer::render() {
     graphics_descriptor_sets.push_back(color_descriptor_sets[prev_image_index]);
     graphics_descriptor_sets.push_back(normal_descriptor_set);
     graphics_descriptor_sets.push_back(position_descriptor_set);
-    graphics_descriptor_sets.push_back(state_descriptor_set);
+    graphics_descriptor_sets.push_back(front_state_descriptor_set);
     graphics_descriptor_sets.push_back(scene_info_descriptor_set);
     graphics_descriptor_sets.push_back(subchunk_state_descriptor_set);
     vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, graphics_pipeline->getPipelineLayout(), 0, graphics_descriptor_sets.size(), graphics_descriptor_sets.data(), 0, nullptr);
 
     vkCmdPushConstants(command_buffer, graphics_pipeline->getPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(RaytraceSettingsPushConstant), &render_settings);
-    group_count_x = (swap_chain->width() / 32) + 1;
-    group_count_y = (swap_chain->height() / 32) + 1;
-    group_count_z = 1;
+    int group_count_x = (swap_chain->width() / 32) + 1;
+    int group_count_y = (swap_chain->height() / 32) + 1;
+    int group_count_z = 1;
     vkCmdDispatch(command_buffer, group_count_x, group_count_y, group_count_z);
     vkCmdPipelineBarrier2(command_buffer, &dep_info);
 
@@ -696,4 +1545,59 @@ void Renderer::render() {
     }
 }
 
+void Renderer::simulate(PhysicsTimings& timings) {
+    if (window) {
+        throw std::runtime_error("Only a headless renderer can simulate outside of a frame!");
+    }
+
+    std::vector<VkDescriptorSet> physics_descriptor_sets;
+    physics_descriptor_sets.push_back(state_descriptor_set);
+    physics_descriptor_sets.push_back(scene_info_descriptor_set);
+    physics_descriptor_sets.push_back(subchunk_state_descriptor_set);
+
+    VkCommandBuffer command_buffer = beginSingleTimeCommands();
+    if (timestamp_pool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(command_buffer, timestamp_pool, 0, PHYSICS_TIMESTAMP_COUNT);
+    }
+
+    resetActiveCells(command_buffer);
+    if (rebuild_occupancy) {
+        recordOccupancyRebuild(command_buffer, physics_descriptor_sets);
+    }
+    edit_queue->record(command_buffer, physics_descriptor_sets, physics_frame);
+
+    recordTimestamp(command_buffer, 0);
+    recordActiveCells(command_buffer, physics_descriptor_sets);
+    recordTimestamp(command_buffer, 1);
+
+    uint32_t pass_count = 8;
+    if (renderer_settings.physics_kernel == PhysicsKernel::MARGOLUS) {
+        recordMargolusSteps(command_buffer, physics_descriptor_sets);
+        pass_count = 2;
+    } else {
+        recordSubchunkPasses(command_buffer, physics_descriptor_sets);
+    }
+    physics_frame++;
+    recordCounterReadback(command_buffer);
+    endSingleTimeCommands(command_buffer);
+
+    vmaInvalidateAllocation(device.allocator(), counter_readback_allocation, 0, VK_WHOLE_SIZE);
+    std::memcpy(&physics_counters, counter_readback_info.pMappedData, sizeof(PhysicsCounters));
+
+    timings.compact_ms = 0.0;
+    timings.pass_ms.clear();
+    if (timestamp_pool == VK_NULL_HANDLE) {
+        return;
+    }
+
+    uint64_t timestamps[PHYSICS_TIMESTAMP_COUNT];
+    vkGetQueryPoolResults(device.device(), timestamp_pool, 0, 2 + pass_count, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    double ms_per_tick = device.properties.limits.timestampPeriod / 1e6;
+    timings.compact_ms = (timestamps[1] - timestamps[0]) * ms_per_tick;
+    for (uint32_t i = 0; i < pass_count; i++) {
+        timings.pass_ms.push_back((timestamps[2 + i] - timestamps[1 + i]) * ms_per_tick);
+    }
+}
+
 }
\ No newline at end of file
@@ -8,27 +8,68 @@
 #include "graphics/swap_chain/swap_chain.h"
 #include "graphics/pipeline/pipeline.h"
 #include "graphics/descriptors/descriptors.h"
-#include "files/state_file.h"
+#include "graphics/snapshot/snapshot_manager.h"
+#include "graphics/edit/edit_queue.h"
+#include "graphics/replay/chunk_hasher.h"
+#include "graphics/streaming/chunk_streamer.h"
+#include "files/mapped_state.h"
+#include "files/world_source.h"
+#include "math/generation/terrain_generator.h"
 #include "settings/settings.h"
 
 #define IMAGE_HISTORY_COUNT 2
 #define SWAPCHAIN_IMAGES 1
 #define TOTAL_COLOR_IMAGES (IMAGE_HISTORY_COUNT + SWAPCHAIN_IMAGES)
 
+// Must match MAX_STATE_SEGMENTS in state.glslh
+#define MAX_STATE_SEGMENTS 32
+#define STATE_MAX_SEGMENT_SIZE (1ull << 30)
+
+// Must match PHYSICS_LOCAL_SIZE in compact.comp and physics_tiled.comp, and physics.comp's local size
+#define PHYSICS_LOCAL_SIZE 64
+// Shared memory physics_tiled.comp needs, PHYSICS_TILE_COUNT tiles of TILE_STRIDE bytes
+#define PHYSICS_TILED_SHARED_SIZE (32 * 1004)
+// physics_fine.comp's workgroup, a row of 64 blocks for each of 16 cells
+#define PHYSICS_FINE_INVOCATIONS (64 * 16)
+// The active cell buffer starts with two sets of indirect dispatch arguments,
+// a workgroup per PHYSICS_LOCAL_SIZE cells and then a workgroup per cell,
+// followed by the PhysicsCounters
+#define ACTIVE_CELLS_CELL_DISPATCH_OFFSET (3 * sizeof(uint32_t))
+#define ACTIVE_CELLS_COUNTERS_OFFSET (6 * sizeof(uint32_t))
+// Timestamps around a headless tick, before and after compaction then after each pass
+#define PHYSICS_TIMESTAMP_COUNT 10
+
 namespace cscd {
 
+// GPU time of a headless physics tick, empty if the device can't time compute work
+struct PhysicsTimings {
+    double compact_ms = 0.0;
+    std::vector<double> pass_ms; // Per subchunk pass, or per Margolus step
+};
+
 class Renderer {
 public:
     const std::string shader_dir = "src/graphics/shaders/";
 
     Renderer(Window& window_, Device& device_, SceneInfo& scene_info_, std::string state_path);
+    // Uploads straight from the source, e.g. a world built in memory
+    Renderer(Window& window_, Device& device_, SceneInfo& scene_info_, file::WorldSource& world_source);
+    Renderer(Window& window_, Device& device_, SceneInfo& scene_info_, file::State&& state);
+    // Procedural world, generated on the GPU without going through a state file.
+    // When streamed, world_dimensions_ is the window kept around the camera.
+    Renderer(Window& window_, Device& device_, SceneInfo& scene_info_, glm::ivec3 world_dimensions_, const generation::TerrainSettings& terrain,
+             bool stream = false);
+    // Headless, physics only with no swap chain or raytracing. Step it with simulate().
+    Renderer(Device& device_, SceneInfo& scene_info_, file::State&& state);
     ~Renderer();
 
     Renderer(const Renderer&) = delete;
     Renderer& operator=(const Renderer&) = delete;
 
     float getAspectRatio() const { return swap_chain->extentAspectRatio(); }
+    glm::ivec3 getWorldDimensions() const { return world_dimensions; }
     bool isFrameInProgress() const { return is_frame_started; }
+    bool isStreaming() const { return chunk_streamer != nullptr; }
 
     VkCommandBuffer getCurrentCommandBuffer() const {
         if (!is_frame_started) {
@@ -45,10 +86,25 @@ public:
     }
 
     void copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size); // Abstract into class at some point
+    void fillBuffer(VkBuffer dst_buffer, VkDeviceSize size, uint32_t value);
+    // Copies the whole world back to the host, waits for the GPU to go idle first
+    void downloadState(std::vector<uint8_t>& voxels);
+
+    // Starts a background snapshot of the world, returns false if one is still being written
+    bool requestSnapshot() { return snapshot_manager->request(); }
+
+    // Written to the world at the start of the next render, before physics
+    void queueEdit(glm::ivec3 location, uint8_t value) { edit_queue->push(location, value); }
+    // Hashes every chunk after the next render's physics, collect once that frame has finished
+    void requestChunkHashes(uint32_t frame) { chunk_hasher->request(frame); }
+    bool collectChunkHashes(uint32_t& frame, std::vector<uint32_t>& hashes) { return chunk_hasher->collect(frame, hashes); }
 
     VkCommandBuffer beginFrame();
-    void render();
+    // Steps physics as many fixed ticks as frame_time covers, up to max_physics_substeps
+    void render(float frame_time);
     void endFrame();
+    // Headless only, runs one physics tick and waits for it to finish
+    void simulate(PhysicsTimings& timings);
 
     PostProcessingPushConstant& getPostprocessSettings() {
         return postprocess_settings;
@@ -58,6 +114,12 @@ public:
         return renderer_settings;
     }
 
+    // Chunk sleep counters from the last physics tick of the last finished frame,
+    // or of the last simulate()
+    const PhysicsCounters& getPhysicsCounters() const {
+        return physics_counters;
+    }
+
     RaytraceSettingsPushConstant& getRaytraceSettings() {
         return render_settings;
     }
@@ -66,17 +128,43 @@ public:
         invalidate_accumulation = true;
     }
 
+    // Runs physics over every chunk next frame and rebuilds the occupancy bitmask,
+    // for when the world changed behind its back
+    void wakeAllChunks() {
+        wake_all_chunks = true;
+        rebuild_occupancy = true;
+    }
+
 private:
+    VkCommandBuffer beginSingleTimeCommands();
+    void endSingleTimeCommands(VkCommandBuffer command_buffer);
+
     void createSamplers();
     void createStateBuffer();
-    void uploadState();
+    void loadWorld(file::WorldSource& world_source);
+    void uploadState(file::WorldSource& world_source);
+    void generateTerrain(const generation::TerrainSettings& terrain);
+    void createWorldResources();
     void createStateDescriptors();
     void createSubchunkStateBuffer();
     void createSubchunkStateDescriptors();
+    int physicsSubsteps(float frame_time);
+    void resetActiveCells(VkCommandBuffer command_buffer);
+    void recordActiveCells(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& physics_descriptor_sets);
+    void recordCounterReadback(VkCommandBuffer command_buffer);
+    void recordOccupancyRebuild(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& physics_descriptor_sets);
+    Pipeline* getPhysicsPipeline();
+    void recordSubchunkPasses(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& physics_descriptor_sets);
+    void recordMargolusSteps(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& physics_descriptor_sets);
+    void recordTimestamp(VkCommandBuffer command_buffer, uint32_t query);
+    void createTimestampPool();
     void createSceneInfoBuffer();
     void createSceneInfoDescriptors();
     void createCommandBuffers();
     void freeCommandBuffers();
+    void createAsyncPhysics();
+    void submitPhysics(uint32_t publish_from, std::vector<VkDescriptorSet>& physics_descriptor_sets);
+    void submitPublish(VkSemaphore wait_semaphore);
     void createSceneInfo(VkExtent2D extent);
     void recreateSceneInfo(VkExtent2D extent);
     void updateSceneInfo();
@@ -91,17 +179,26 @@ private:
     PostProcessingPushConstant postprocess_settings{};
     RendererSettings renderer_settings{};
 
-    Window& window;
+    Window* window; // Null when headless
     Device& device;
     std::unique_ptr<SwapChain> swap_chain;
     std::vector<VkCommandBuffer> command_buffers;
+    // Recorded and submitted to the physics queue, only used with async physics
+    VkCommandBuffer physics_command_buffer = VK_NULL_HANDLE;
+    VkCommandBuffer publish_command_buffer = VK_NULL_HANDLE;
+    VkFence physics_fence = VK_NULL_HANDLE;
+    VkSemaphore publish_semaphore = VK_NULL_HANDLE; // Front copy written, the next render waits on it
+    VkSemaphore render_semaphore = VK_NULL_HANDLE; // Front copy read, the frame's publish waits on it
+    bool front_published = false;
+    bool publish_pending = false;
+    bool publish_signalled = false;
 
     std::vector<VkImage> color_images;
     VkImage normal_image = VK_NULL_HANDLE;
     VkImage position_image = VK_NULL_HANDLE;
     std::vector<VmaAllocation> color_allocations;
-    VmaAllocation normal_allocation;
-    VmaAllocation position_allocation;
+    VmaAllocation normal_allocation = VK_NULL_HANDLE;
+    VmaAllocation position_allocation = VK_NULL_HANDLE;
     std::vector<VkImageView> color_image_views;
     VkImageView normal_image_view = VK_NULL_HANDLE;
     VkImageView position_image_view = VK_NULL_HANDLE;
@@ -113,11 +210,45 @@ private:
     VmaAllocation scene_info_allocation;
     VmaAllocationInfo scene_info_mapped;
 
-    file::State world_state;
-    VkBuffer state_buffer;
-    VmaAllocation state_allocation;
+    glm::ivec3 world_dimensions;
+    VkDeviceSize world_size;
+    uint32_t state_segment_layers;
+    std::vector<VkBuffer> state_buffers;
+    std::vector<VmaAllocation> state_allocations;
+    // A bit per voxel, a buffer per state segment (see state.glslh)
+    std::vector<VkBuffer> occupancy_buffers;
+    std::vector<VmaAllocation> occupancy_allocations;
+    bool rebuild_occupancy = true;
+    // With async physics the raytracer reads a front copy of the state and
+    // occupancy, brought up to date with the chunks physics wrote each frame
+    bool async_physics = false;
+    std::vector<VkBuffer> front_state_buffers;
+    std::vector<VmaAllocation> front_state_allocations;
+    std::vector<VkBuffer> front_occupancy_buffers;
+    std::vector<VmaAllocation> front_occupancy_allocations;
     VkBuffer subchunk_state_buffer;
     VmaAllocation subchunk_state_allocation;
+    VkBuffer chunk_flags_buffer;
+    VmaAllocation chunk_flags_allocation;
+    // Last physics frame each chunk was written in
+    VkBuffer chunk_activity_buffer;
+    VmaAllocation chunk_activity_allocation;
+    // Indirect dispatch sizes and the physics counters, then the list of physics cells to run
+    VkBuffer active_cells_buffer;
+    VmaAllocation active_cells_allocation;
+    VkBuffer counter_readback_buffer;
+    VmaAllocation counter_readback_allocation;
+    VmaAllocationInfo counter_readback_info;
+    PhysicsCounters physics_counters{};
+    uint32_t physics_cell_count = 0;
+    uint32_t physics_frame = 1;
+    // Seconds of simulation owed that haven't made up a whole tick yet
+    float physics_accumulator = 0.0f;
+    bool wake_all_chunks = true;
+    // Storage chunk columns streamed in this frame, their occupancy is rebuilt and they are woken and marked dirty before physics
+    std::vector<glm::ivec2> streamed_columns;
+    // Only created headless, timing in the render loop would stall on the results
+    VkQueryPool timestamp_pool = VK_NULL_HANDLE;
 
     uint32_t prev_image_index{0};
     uint32_t curr_image_index{0};
@@ -130,8 +261,19 @@ private:
 
     std::unique_ptr<Pipeline> graphics_pipeline;
     std::unique_ptr<Pipeline> physics_pipeline;
+    std::unique_ptr<Pipeline> physics_tiled_pipeline; // Null if the device lacks the shared memory
+    std::unique_ptr<Pipeline> physics_fine_pipeline; // Null if the device lacks subgroup ballots or large workgroups
+    std::unique_ptr<Pipeline> compact_pipeline;
+    std::unique_ptr<Pipeline> occupancy_pipeline;
+    std::unique_ptr<Pipeline> margolus_pipeline;
+    std::unique_ptr<Pipeline> publish_pipeline; // Null without async physics
     std::unique_ptr<Pipeline> postprocess_pipeline;
 
+    std::unique_ptr<SnapshotManager> snapshot_manager;
+    std::unique_ptr<EditQueue> edit_queue;
+    std::unique_ptr<ChunkHasher> chunk_hasher;
+    std::unique_ptr<ChunkStreamer> chunk_streamer;
+
     std::unique_ptr<DescriptorPool> frame_pool{};
     std::unique_ptr<DescriptorPool> normal_pool{};
     std::unique_ptr<DescriptorPool> position_pool{};
@@ -149,6 +291,7 @@ private:
     VkDescriptorSet normal_descriptor_set;
     VkDescriptorSet position_descriptor_set;
     VkDescriptorSet state_descriptor_set;
+    VkDescriptorSet front_state_descriptor_set;
     VkDescriptorSet subchunk_state_descriptor_set;
     VkDescriptorSet scene_info_descriptor_set;
 };
@@ -0,0 +1,106 @@
+#include <cstring>
+#include <stdexcept>
+#include "chunk_hasher.h"
+#include "files/chunked_state.h"
+
+namespace cscd {
+
+ChunkHasher::ChunkHasher(Device& device_, glm::ivec3 world_dimensions, int chunk_size,
+                         std::vector<VkDescriptorSetLayout> world_set_layouts, const std::string& shader_path) :
+    device{device_}
+{
+    file::ChunkGrid grid{glm::uvec3(world_dimensions), (uint32_t)chunk_size};
+    chunk_count = grid.chunkCount();
+
+    VkBufferCreateInfo buffer_create_info{};
+    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.size = chunk_count * sizeof(uint32_t);
+    buffer_create_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    VmaAllocationCreateInfo allocation_info{};
+    allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+    allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    if (vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &hash_buffer, &hash_allocation, &hash_info) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create chunk hash buffer!");
+    }
+
+    createDescriptors();
+
+    world_set_layouts.push_back(hash_set_layout->getDescriptorSetLayout());
+
+    std::vector<VkPushConstantRange> push_const_ranges{};
+    hash_pipeline = std::make_unique<Pipeline>(device, shader_path, world_set_layouts, push_const_ranges);
+}
+
+ChunkHasher::~ChunkHasher() {
+    vmaDestroyBuffer(device.allocator(), hash_buffer, hash_allocation);
+}
+
+void ChunkHasher::createDescriptors() {
+    hash_set_layout = DescriptorSetLayout::Builder(device)
+    .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+    .build();
+
+    hash_pool = DescriptorPool::Builder(device)
+    .setMaxSets(1)
+    .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
+    .build();
+
+    VkDescriptorBufferInfo buffer_info{};
+    buffer_info.buffer = hash_buffer;
+    buffer_info.offset = 0;
+    buffer_info.range = VK_WHOLE_SIZE;
+
+    DescriptorWriter(*hash_set_layout, *hash_pool)
+    .writeBuffer(0, &buffer_info)
+    .build(hash_descriptor_set);
+}
+
+void ChunkHasher::request(uint32_t frame) {
+    requested = true;
+    requested_frame = frame;
+}
+
+void ChunkHasher::record(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets) {
+    if (!requested) {
+        return;
+    }
+
+    std::vector<VkDescriptorSet> descriptor_sets = world_descriptor_sets;
+    descriptor_sets.push_back(hash_descriptor_set);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, hash_pipeline->getPipeline());
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, hash_pipeline->getPipelineLayout(), 0, descriptor_sets.size(), descriptor_sets.data(), 0, nullptr);
+    vkCmdDispatch(command_buffer, (chunk_count + 63) / 64, 1, 1);
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+
+    requested = false;
+    recorded = true;
+}
+
+bool ChunkHasher::collect(uint32_t& frame, std::vector<uint32_t>& hashes) {
+    if (!recorded) {
+        return false;
+    }
+
+    vmaInvalidateAllocation(device.allocator(), hash_allocation, 0, VK_WHOLE_SIZE);
+    hashes.resize(chunk_count);
+    std::memcpy(hashes.data(), hash_info.pMappedData, chunk_count * sizeof(uint32_t));
+    frame = requested_frame;
+    recorded = false;
+    return true;
+}
+
+}
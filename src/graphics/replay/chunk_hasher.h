@@ -0,0 +1,53 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <memory>
+#include <vector>
+#include <string>
+#include "glm/glm.hpp"
+#include "graphics/device/device.h"
+#include "graphics/pipeline/pipeline.h"
+#include "graphics/descriptors/descriptors.h"
+
+namespace cscd {
+
+// Hashes every chunk of the device local world on the GPU, used to check a
+// replayed run against its recording. Hashes requested in one frame can be
+// collected once that frame has finished executing.
+class ChunkHasher {
+public:
+    ChunkHasher(Device& device_, glm::ivec3 world_dimensions, int chunk_size,
+                std::vector<VkDescriptorSetLayout> world_set_layouts, const std::string& shader_path);
+    ~ChunkHasher();
+
+    ChunkHasher(const ChunkHasher&) = delete;
+    ChunkHasher& operator=(const ChunkHasher&) = delete;
+
+    void request(uint32_t frame);
+    // Must be recorded after physics, world_descriptor_sets match world_set_layouts
+    void record(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets);
+    // Returns false if no hashes are waiting
+    bool collect(uint32_t& frame, std::vector<uint32_t>& hashes);
+
+private:
+    void createDescriptors();
+
+    Device& device;
+    uint32_t chunk_count;
+
+    bool requested = false;
+    bool recorded = false;
+    uint32_t requested_frame = 0;
+
+    VkBuffer hash_buffer = VK_NULL_HANDLE;
+    VmaAllocation hash_allocation = VK_NULL_HANDLE;
+    VmaAllocationInfo hash_info{};
+
+    std::unique_ptr<Pipeline> hash_pipeline;
+    std::unique_ptr<DescriptorSetLayout> hash_set_layout{};
+    std::unique_ptr<DescriptorPool> hash_pool{};
+    VkDescriptorSet hash_descriptor_set = VK_NULL_HANDLE;
+};
+
+}
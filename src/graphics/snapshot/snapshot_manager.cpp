@@ -0,0 +1,369 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include "snapshot_manager.h"
+#include "files/snapshot_file.h"
+
+namespace cscd {
+
+SnapshotManager::SnapshotManager(Device& device_, glm::ivec3 world_dimensions, int chunk_size, VkBuffer chunk_flags_buffer_,
+                                 std::vector<VkDescriptorSetLayout> world_set_layouts, const std::string& shader_path,
+                                 std::string output_dir_) :
+    device{device_},
+    grid{glm::uvec3(world_dimensions), (uint32_t)chunk_size},
+    chunk_flags_buffer{chunk_flags_buffer_},
+    output_dir{output_dir_},
+    chunk_stride{(size_t)chunk_size * chunk_size * chunk_size}
+{
+    // A slot is bound whole, and its chunk offsets stay within 32 bits in the shader
+    VkDeviceSize batch_bytes = std::min<VkDeviceSize>(SNAPSHOT_BATCH_BYTES, device.properties.limits.maxStorageBufferRange);
+    batch_chunks = std::max<VkDeviceSize>(batch_bytes / chunk_stride, 1);
+
+    createBuffer(grid.chunkCount() * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                 flag_readback_buffer, flag_readback_allocation, flag_readback_info);
+
+    createGatherDescriptors();
+
+    std::vector<VkPushConstantRange> push_const_ranges{};
+    world_set_layouts.push_back(gather_set_layout->getDescriptorSetLayout());
+    gather_pipeline = std::make_unique<Pipeline>(device, shader_path, world_set_layouts, push_const_ranges);
+
+    worker = std::thread([this]() {
+        workerLoop();
+    });
+}
+
+SnapshotManager::~SnapshotManager() {
+    // Also gives up on a snapshot still waiting for batches
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        stop_worker = true;
+    }
+    worker_cv.notify_all();
+    worker.join();
+
+    releaseGatherBuffers();
+    vmaDestroyBuffer(device.allocator(), flag_readback_buffer, flag_readback_allocation);
+}
+
+void SnapshotManager::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags,
+                                   VkBuffer& buffer, VmaAllocation& allocation, VmaAllocationInfo& info) {
+    VkBufferCreateInfo buffer_create_info{};
+    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.size = size;
+    buffer_create_info.usage = usage;
+
+    VmaAllocationCreateInfo allocation_info{};
+    allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+    allocation_info.flags = flags;
+
+    if (vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &buffer, &allocation, &info) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create snapshot buffer!");
+    }
+}
+
+void SnapshotManager::createGatherDescriptors() {
+    gather_set_layout = DescriptorSetLayout::Builder(device)
+    .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+    .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+    .build();
+
+    gather_pool = DescriptorPool::Builder(device)
+    .setMaxSets(SNAPSHOT_RING_SIZE)
+    .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * SNAPSHOT_RING_SIZE)
+    .build();
+
+    for (auto& slot : ring) {
+        if (!gather_pool->allocateDescriptor(gather_set_layout->getDescriptorSetLayout(), slot.descriptor_set)) {
+            throw std::runtime_error("Failed to allocate snapshot descriptor set!");
+        }
+    }
+}
+
+bool SnapshotManager::request() {
+    if (stage != Stage::IDLE) {
+        return false;
+    }
+    stage = Stage::REQUESTED;
+    return true;
+}
+
+void SnapshotManager::recordFlagReadback(VkCommandBuffer command_buffer) {
+    if (stage != Stage::REQUESTED) {
+        return;
+    }
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+
+    VkBufferCopy copy_region{};
+    copy_region.size = grid.chunkCount() * sizeof(uint32_t);
+    vkCmdCopyBuffer(command_buffer, chunk_flags_buffer, flag_readback_buffer, 1, &copy_region);
+
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT_KHR;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+
+    stage = Stage::FLAGS_PENDING;
+}
+
+void SnapshotManager::recordGather(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets) {
+    // Only one frame is ever in flight, so by the time this is recorded the
+    // previous frame's copies have landed
+    switch (stage) {
+    case Stage::FLAGS_PENDING:
+        prepareGather(command_buffer, world_descriptor_sets);
+        break;
+    case Stage::GATHERING:
+        recordBatches(command_buffer, world_descriptor_sets);
+        break;
+    case Stage::WRITING:
+        recordBatches(command_buffer, world_descriptor_sets);
+        if (job_done) {
+            releaseGatherBuffers();
+            stage = Stage::IDLE;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void SnapshotManager::prepareGather(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets) {
+    vmaInvalidateAllocation(device.allocator(), flag_readback_allocation, 0, VK_WHOLE_SIZE);
+    const uint32_t* flags = static_cast<const uint32_t*>(flag_readback_info.pMappedData);
+
+    // The base snapshot holds every chunk
+    gathered_chunks.clear();
+    for (uint32_t i = 0; i < grid.chunkCount(); i++) {
+        if (sequence == 0 || (flags[i] & CHUNK_FLAG_DIRTY)) {
+            gathered_chunks.push_back(i);
+        }
+    }
+
+    batch_count = (gathered_chunks.size() + batch_chunks - 1) / batch_chunks;
+    next_batch = 0;
+    if (batch_count != 0) {
+        createRing();
+    }
+
+    // The writer starts right away and waits on each batch as it needs it
+    submitJob();
+    stage = Stage::GATHERING;
+    recordBatches(command_buffer, world_descriptor_sets);
+}
+
+void SnapshotManager::createRing() {
+    uint32_t slot_chunks = std::min<uint32_t>(batch_chunks, gathered_chunks.size());
+    for (auto& slot : ring) {
+        createBuffer(sizeof(uint32_t) * (slot_chunks + 1), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                     slot.list_buffer, slot.list_allocation, slot.list_info);
+        createBuffer(chunk_stride * slot_chunks, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                     slot.data_buffer, slot.data_allocation, slot.data_info);
+        slot.state = SlotState::FREE;
+
+        VkDescriptorBufferInfo list_buffer_info{};
+        list_buffer_info.buffer = slot.list_buffer;
+        list_buffer_info.offset = 0;
+        list_buffer_info.range = VK_WHOLE_SIZE;
+
+        VkDescriptorBufferInfo data_buffer_info{};
+        data_buffer_info.buffer = slot.data_buffer;
+        data_buffer_info.offset = 0;
+        data_buffer_info.range = VK_WHOLE_SIZE;
+
+        DescriptorWriter(*gather_set_layout, *gather_pool)
+        .writeBuffer(0, &list_buffer_info)
+        .writeBuffer(1, &data_buffer_info)
+        .overwrite(slot.descriptor_set);
+    }
+}
+
+void SnapshotManager::recordBatches(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets) {
+    // Batch b always goes through slot b % SNAPSHOT_RING_SIZE, so the writer
+    // knows where to wait for it
+    uint32_t free_batches = 0;
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        for (auto& slot : ring) {
+            if (slot.state == SlotState::IN_FLIGHT) {
+                vmaInvalidateAllocation(device.allocator(), slot.data_allocation, 0, VK_WHOLE_SIZE);
+                slot.state = SlotState::READY;
+            }
+        }
+        while (next_batch + free_batches < batch_count && free_batches < SNAPSHOT_RING_SIZE &&
+               ring[(next_batch + free_batches) % SNAPSHOT_RING_SIZE].state == SlotState::FREE) {
+            free_batches++;
+        }
+    }
+    worker_cv.notify_all();
+
+    if (stage != Stage::GATHERING) {
+        return;
+    } else if (next_batch < batch_count && job_done) {
+        // The writer gave up, nothing it hasn't taken yet will be written
+        std::cerr << "Snapshot " << sequence - 1 << " stopped after " << next_batch << " of " << batch_count << " batches" << std::endl;
+        stage = Stage::WRITING;
+        return;
+    }
+
+    if (free_batches != 0) {
+        std::vector<VkDescriptorSet> descriptor_sets = world_descriptor_sets;
+        descriptor_sets.push_back(VK_NULL_HANDLE);
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gather_pipeline->getPipeline());
+
+        for (uint32_t i = 0; i < free_batches; i++) {
+            Slot* slot = &ring[next_batch % SNAPSHOT_RING_SIZE];
+            uint32_t first = next_batch * batch_chunks;
+            uint32_t chunk_count = std::min<uint32_t>(batch_chunks, gathered_chunks.size() - first);
+            uint8_t* list = static_cast<uint8_t*>(slot->list_info.pMappedData);
+            std::memcpy(list, &chunk_count, sizeof(uint32_t));
+            std::memcpy(list + sizeof(uint32_t), gathered_chunks.data() + first, sizeof(uint32_t) * chunk_count);
+            vmaFlushAllocation(device.allocator(), slot->list_allocation, 0, VK_WHOLE_SIZE);
+
+            descriptor_sets.back() = slot->descriptor_set;
+            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, gather_pipeline->getPipelineLayout(), 0, descriptor_sets.size(), descriptor_sets.data(), 0, nullptr);
+            vkCmdDispatch(command_buffer, std::min<uint32_t>(chunk_count, 65535), 1, 1);
+
+            std::lock_guard<std::mutex> lock(worker_mutex);
+            slot->batch = next_batch;
+            slot->chunk_count = chunk_count;
+            slot->taken = 0;
+            slot->state = SlotState::IN_FLIGHT;
+            next_batch++;
+        }
+
+        // Physics must see the cleared dirty flags, the host reads the gathered chunks next frame
+        VkMemoryBarrier2 barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+        barrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_HOST_BIT_KHR;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT_KHR | VK_ACCESS_2_SHADER_WRITE_BIT_KHR | VK_ACCESS_2_HOST_READ_BIT_KHR;
+
+        VkDependencyInfoKHR dep_info{};
+        dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+        dep_info.memoryBarrierCount = 1;
+        dep_info.pMemoryBarriers = &barrier;
+        vkCmdPipelineBarrier2(command_buffer, &dep_info);
+    }
+
+    // The world may change again once the last batch is recorded, it's gathered before physics
+    if (next_batch == batch_count) {
+        stage = Stage::WRITING;
+    }
+}
+
+void SnapshotManager::releaseGatherBuffers() {
+    for (auto& slot : ring) {
+        if (slot.list_buffer != VK_NULL_HANDLE) {
+            vmaDestroyBuffer(device.allocator(), slot.list_buffer, slot.list_allocation);
+            slot.list_buffer = VK_NULL_HANDLE;
+        }
+        if (slot.data_buffer != VK_NULL_HANDLE) {
+            vmaDestroyBuffer(device.allocator(), slot.data_buffer, slot.data_allocation);
+            slot.data_buffer = VK_NULL_HANDLE;
+        }
+        slot.state = SlotState::FREE;
+    }
+}
+
+void SnapshotManager::submitJob() {
+    auto job = std::make_unique<Job>();
+    job->chunks = gathered_chunks;
+    job->sequence = sequence++;
+
+    job_done = false;
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        pending_job = std::move(job);
+    }
+    worker_cv.notify_all();
+}
+
+void SnapshotManager::workerLoop() {
+    while (true) {
+        std::unique_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(worker_mutex);
+            worker_cv.wait(lock, [this]() { return stop_worker || pending_job != nullptr; });
+            if (pending_job == nullptr) {
+                return;
+            }
+            job = std::move(pending_job);
+        }
+
+        try {
+            writeJob(*job);
+        } catch (const std::exception& e) {
+            std::cerr << "Snapshot " << job->sequence << " failed: " << e.what() << std::endl;
+        }
+        job_done = true;
+    }
+}
+
+void SnapshotManager::writeJob(const Job& job) {
+    std::filesystem::create_directories(output_dir);
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "snapshot_%06u.%s", job.sequence, job.sequence == 0 ? "ccst" : "ccsd");
+    std::string path = output_dir + "/" + name;
+
+    if (job.sequence == 0) {
+        // Every chunk was gathered in order, so chunk i is at position i
+        file::writeChunkedState(path, grid.dimensions, grid.chunk_size, file::ChunkCodecType::RLE,
+            [&](uint32_t index, uint8_t* scratch) {
+                takeChunk(index, index, scratch);
+                return (const uint8_t*)scratch;
+            }, file::VoxelPacking::BYTE, encode_pool);
+    } else {
+        file::writeSnapshotDelta(path, grid, job.sequence, job.chunks,
+            [&](uint32_t index, uint8_t* scratch) {
+                uint32_t position = std::lower_bound(job.chunks.begin(), job.chunks.end(), index) - job.chunks.begin();
+                takeChunk(position, index, scratch);
+                return (const uint8_t*)scratch;
+            });
+    }
+
+    std::cout << "Wrote snapshot " << path << " (" << job.chunks.size() << " chunks)" << std::endl;
+}
+
+void SnapshotManager::takeChunk(uint32_t position, uint32_t chunk_index, uint8_t* chunk) {
+    uint32_t batch = position / batch_chunks;
+    Slot& slot = ring[batch % SNAPSHOT_RING_SIZE];
+    std::unique_lock<std::mutex> lock(worker_mutex);
+    worker_cv.wait(lock, [&]() { return stop_worker || (slot.state == SlotState::READY && slot.batch == batch); });
+    if (stop_worker) {
+        throw std::runtime_error("Snapshot cancelled!");
+    }
+
+    // The slot can't be reused until this chunk is counted as taken
+    lock.unlock();
+    const uint8_t* data = static_cast<const uint8_t*>(slot.data_info.pMappedData);
+    std::memcpy(chunk, data + (size_t)(position - batch * batch_chunks) * chunk_stride, grid.chunkVolume(chunk_index));
+    lock.lock();
+
+    if (++slot.taken == slot.chunk_count) {
+        slot.state = SlotState::FREE;
+    }
+}
+
+}
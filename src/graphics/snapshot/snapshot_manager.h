@@ -0,0 +1,144 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "glm/glm.hpp"
+#include "graphics/device/device.h"
+#include "graphics/pipeline/pipeline.h"
+#include "graphics/descriptors/descriptors.h"
+#include "files/chunked_state.h"
+#include "threading/thread_pool.h"
+
+// Host visible staging per ring slot, 16^3 chunks are gathered 16384 at a time
+#define SNAPSHOT_BATCH_BYTES (64ull * 1024 * 1024)
+#define SNAPSHOT_RING_SIZE 2
+// Must match sleep.glslh
+#define CHUNK_FLAG_DIRTY 1u
+
+namespace cscd {
+
+// Checkpoints the device local world without stalling the frame loop. The
+// first snapshot is a full CCS2 base file, later ones are deltas holding only
+// the chunks physics marked dirty since the previous snapshot.
+//
+// The dirty flags are copied back after physics. From the next frame on the
+// listed chunks are gathered before physics in batches, into a ring of
+// SNAPSHOT_RING_SIZE host visible buffers, while a worker thread encodes and
+// writes each landed batch. A slot is only gathered into again once the
+// writer has taken every chunk in it, so staging stays bounded whatever the
+// world size. Physics, edits and streaming hold off until the last batch is
+// recorded, so every chunk in a snapshot is from the same frame.
+class SnapshotManager {
+public:
+    SnapshotManager(Device& device_, glm::ivec3 world_dimensions, int chunk_size, VkBuffer chunk_flags_buffer_,
+                    std::vector<VkDescriptorSetLayout> world_set_layouts, const std::string& shader_path,
+                    std::string output_dir_);
+    ~SnapshotManager();
+
+    SnapshotManager(const SnapshotManager&) = delete;
+    SnapshotManager& operator=(const SnapshotManager&) = delete;
+
+    // Returns false if a snapshot is already in progress
+    bool request();
+    bool isBusy() const { return stage != Stage::IDLE; }
+    // While true the world must not change, batches of the snapshot are still to be gathered
+    bool isGathering() const { return stage == Stage::GATHERING; }
+    uint32_t getSequence() const { return sequence; }
+
+    // Must be recorded before physics, world_descriptor_sets match world_set_layouts
+    void recordGather(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets);
+    // Must be recorded after physics
+    void recordFlagReadback(VkCommandBuffer command_buffer);
+
+private:
+    enum class Stage {
+        IDLE,
+        REQUESTED,
+        FLAGS_PENDING,
+        GATHERING,
+        WRITING
+    };
+
+    enum class SlotState {
+        FREE,
+        IN_FLIGHT,  // Gathered into by the frame being recorded or the one before it
+        READY       // Landed, the writer is taking chunks out of it
+    };
+
+    // Holds batch, chunks [batch * batch_chunks, + chunk_count) of the gathered list
+    struct Slot {
+        VkBuffer list_buffer = VK_NULL_HANDLE;
+        VmaAllocation list_allocation = VK_NULL_HANDLE;
+        VmaAllocationInfo list_info{};
+        VkBuffer data_buffer = VK_NULL_HANDLE;
+        VmaAllocation data_allocation = VK_NULL_HANDLE;
+        VmaAllocationInfo data_info{};
+        VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+
+        SlotState state = SlotState::FREE;
+        uint32_t batch = 0;
+        uint32_t chunk_count = 0;
+        uint32_t taken = 0;
+    };
+
+    struct Job {
+        std::vector<uint32_t> chunks;
+        uint32_t sequence = 0;
+    };
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags,
+                      VkBuffer& buffer, VmaAllocation& allocation, VmaAllocationInfo& info);
+    void createGatherDescriptors();
+    void prepareGather(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets);
+    void createRing();
+    // Hands landed batches to the writer and gathers the next ones into free slots
+    void recordBatches(VkCommandBuffer command_buffer, std::vector<VkDescriptorSet>& world_descriptor_sets);
+    void releaseGatherBuffers();
+    void submitJob();
+    void workerLoop();
+    void writeJob(const Job& job);
+    // Waits for the batch holding position of the gathered list to land, then copies the chunk out
+    void takeChunk(uint32_t position, uint32_t chunk_index, uint8_t* chunk);
+
+    Device& device;
+    file::ChunkGrid grid;
+    VkBuffer chunk_flags_buffer;
+    std::string output_dir;
+    size_t chunk_stride;
+    uint32_t batch_chunks;
+
+    Stage stage = Stage::IDLE;
+    uint32_t sequence = 0;
+    std::vector<uint32_t> gathered_chunks;
+    uint32_t batch_count = 0;
+    uint32_t next_batch = 0;
+
+    VkBuffer flag_readback_buffer = VK_NULL_HANDLE;
+    VmaAllocation flag_readback_allocation = VK_NULL_HANDLE;
+    VmaAllocationInfo flag_readback_info{};
+    // Slot state is shared with the writer, guarded by worker_mutex
+    Slot ring[SNAPSHOT_RING_SIZE];
+
+    std::unique_ptr<Pipeline> gather_pipeline;
+    std::unique_ptr<DescriptorSetLayout> gather_set_layout{};
+    std::unique_ptr<DescriptorPool> gather_pool{};
+
+    // The writer blocks on batches that haven't landed yet, so it gets a pool
+    // of its own rather than holding up the shared one
+    ThreadPool encode_pool{};
+    std::thread worker;
+    std::mutex worker_mutex;
+    std::condition_variable worker_cv;
+    std::unique_ptr<Job> pending_job;
+    bool stop_worker = false;
+    std::atomic_bool job_done{false};
+};
+
+}
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include "chunk_streamer.h"
+
+namespace cscd {
+
+static int floorMod(int value, int divisor) {
+    return ((value % divisor) + divisor) % divisor;
+}
+
+ChunkStreamer::ChunkStreamer(Device& device_, SceneInfo& scene_info_, std::vector<VkBuffer> state_buffers_, uint32_t state_segment_layers_,
+                             ColumnProvider provider_, VkDeviceSize upload_budget_) :
+    device{device_},
+    scene_info{scene_info_},
+    state_buffers{std::move(state_buffers_)},
+    state_segment_layers{state_segment_layers_},
+    provider{std::move(provider_)}
+{
+    chunk_size = scene_info.chunk_size;
+    window_dimensions = scene_info.world_dimensions;
+    if (window_dimensions.x % chunk_size != 0 || window_dimensions.z % chunk_size != 0) {
+        throw std::runtime_error("Streamed worlds must be a whole number of chunks across!");
+    }
+    // Columns are copied into a single segment
+    if (state_segment_layers % chunk_size != 0) {
+        throw std::runtime_error("Streamed world layers are too large to keep whole chunks in a segment!");
+    }
+
+    window_chunks = glm::ivec2(window_dimensions.x, window_dimensions.z) / chunk_size;
+    column_size = (VkDeviceSize)chunk_size * window_dimensions.y * chunk_size;
+    upload_budget = std::max(upload_budget_, column_size);
+
+    VkBufferCreateInfo buffer_create_info{};
+    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.size = upload_budget;
+    buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VmaAllocationCreateInfo allocation_info{};
+    allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+    allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    if (vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &staging_buffer, &staging_allocation, &staging_info) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create chunk streaming staging buffer!");
+    }
+
+    // The initial window is filled by the caller, so nothing is requested yet
+    origin_chunk = glm::ivec2(scene_info.window_origin.x, scene_info.window_origin.z) / chunk_size;
+    glm::ivec2 centred = cameraChunk() - window_chunks / 2;
+    moveWindow(centred);
+    pending.clear();
+    requests.clear();
+
+    worker = std::thread([this]() {
+        workerLoop();
+    });
+}
+
+ChunkStreamer::~ChunkStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        stop_worker = true;
+    }
+    worker_cv.notify_all();
+    worker.join();
+
+    vmaDestroyBuffer(device.allocator(), staging_buffer, staging_allocation);
+}
+
+glm::ivec2 ChunkStreamer::cameraChunk() const {
+    glm::vec2 camera = glm::vec2(scene_info.camera_position.x + scene_info.window_origin.x,
+                                 scene_info.camera_position.z + scene_info.window_origin.z);
+    return glm::ivec2(glm::floor(camera / (float)chunk_size));
+}
+
+bool ChunkStreamer::inWindow(glm::ivec2 chunk) const {
+    glm::ivec2 local = chunk - origin_chunk;
+    return local.x >= 0 && local.y >= 0 && local.x < window_chunks.x && local.y < window_chunks.y;
+}
+
+bool ChunkStreamer::update() {
+    glm::ivec2 centred = cameraChunk() - window_chunks / 2;
+    if (centred == origin_chunk) {
+        return false;
+    }
+    moveWindow(centred);
+    return true;
+}
+
+void ChunkStreamer::moveWindow(glm::ivec2 new_origin_chunk) {
+    glm::ivec2 old_origin_chunk = origin_chunk;
+    origin_chunk = new_origin_chunk;
+
+    // Keep the camera where it was in world space
+    glm::ivec2 shift = (origin_chunk - old_origin_chunk) * chunk_size;
+    scene_info.camera_position.x -= shift.x;
+    scene_info.camera_position.z -= shift.y;
+    scene_info.old_camera_position.x -= shift.x;
+    scene_info.old_camera_position.z -= shift.y;
+
+    scene_info.window_origin = glm::ivec3(origin_chunk.x * chunk_size, 0, origin_chunk.y * chunk_size);
+    scene_info.window_offset = glm::ivec3(floorMod(scene_info.window_origin.x, window_dimensions.x), 0,
+                                          floorMod(scene_info.window_origin.z, window_dimensions.z));
+
+    auto outside = [this](glm::ivec2 chunk) { return !inWindow(chunk); };
+    pending.erase(std::remove_if(pending.begin(), pending.end(), outside), pending.end());
+
+    std::vector<glm::ivec2> entering;
+    for (int z = 0; z < window_chunks.y; z++) {
+        for (int x = 0; x < window_chunks.x; x++) {
+            glm::ivec2 chunk = origin_chunk + glm::ivec2(x, z);
+            glm::ivec2 old_local = chunk - old_origin_chunk;
+            if (old_local.x < 0 || old_local.y < 0 || old_local.x >= window_chunks.x || old_local.y >= window_chunks.y) {
+                entering.push_back(chunk);
+            }
+        }
+    }
+    pending.insert(pending.end(), entering.begin(), entering.end());
+
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        requests.erase(std::remove_if(requests.begin(), requests.end(), outside), requests.end());
+        requests.insert(requests.end(), entering.begin(), entering.end());
+        finished.erase(std::remove_if(finished.begin(), finished.end(), [&](const Column& column) { return outside(column.chunk); }), finished.end());
+        priority_chunk = cameraChunk();
+    }
+    worker_cv.notify_one();
+}
+
+void ChunkStreamer::workerLoop() {
+    while (true) {
+        glm::ivec2 chunk;
+        {
+            std::unique_lock<std::mutex> lock(worker_mutex);
+            worker_cv.wait(lock, [this]() { return stop_worker || !requests.empty(); });
+            if (stop_worker) {
+                return;
+            }
+
+            // Nearest the camera first, the list is short enough to scan
+            auto distance = [this](glm::ivec2 chunk) {
+                glm::ivec2 delta = chunk - priority_chunk;
+                return delta.x * delta.x + delta.y * delta.y;
+            };
+            auto nearest = std::min_element(requests.begin(), requests.end(), [&](glm::ivec2 a, glm::ivec2 b) {
+                return distance(a) < distance(b);
+            });
+            chunk = *nearest;
+            *nearest = requests.back();
+            requests.pop_back();
+        }
+
+        Column column{chunk, std::vector<uint8_t>(column_size)};
+        try {
+            provider(glm::ivec3(chunk.x * chunk_size, 0, chunk.y * chunk_size),
+                     glm::ivec3(chunk_size, window_dimensions.y, chunk_size), column.voxels.data());
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to stream chunk column (" << chunk.x << ", " << chunk.y << "): " << e.what() << std::endl;
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        finished.push_back(std::move(column));
+    }
+}
+
+bool ChunkStreamer::record(VkCommandBuffer command_buffer, std::vector<glm::ivec2>& copied) {
+    std::vector<Column> columns;
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        columns.swap(finished);
+    }
+    if (columns.empty()) {
+        return false;
+    }
+
+    // Only one frame is ever in flight, so the staging buffer is free again
+    uint8_t* staging = static_cast<uint8_t*>(staging_info.pMappedData);
+    VkDeviceSize staged = 0;
+    VkDeviceSize layer_size = (VkDeviceSize)window_dimensions.x * window_dimensions.y;
+    std::vector<VkBufferCopy> copy_regions(chunk_size * window_dimensions.y);
+    std::vector<Column> deferred;
+
+    for (Column& column : columns) {
+        auto waiting = std::find(pending.begin(), pending.end(), column.chunk);
+        if (waiting == pending.end()) {
+            continue;
+        }
+        if (staged + column_size > upload_budget) {
+            deferred.push_back(std::move(column));
+            continue;
+        }
+
+        std::memcpy(staging + staged, column.voxels.data(), column_size);
+
+        // The column's slot is where its world position wraps to in the buffers
+        int storage_x = floorMod(column.chunk.x, window_chunks.x) * chunk_size;
+        int storage_z = floorMod(column.chunk.y, window_chunks.y) * chunk_size;
+        uint32_t segment = storage_z / state_segment_layers;
+        uint32_t segment_z = storage_z % state_segment_layers;
+        for (int z = 0; z < chunk_size; z++) {
+            for (int y = 0; y < window_dimensions.y; y++) {
+                VkBufferCopy& copy_region = copy_regions[z * window_dimensions.y + y];
+                copy_region.srcOffset = staged + ((VkDeviceSize)z * window_dimensions.y + y) * chunk_size;
+                copy_region.dstOffset = (segment_z + z) * layer_size + (VkDeviceSize)y * window_dimensions.x + storage_x;
+                copy_region.size = chunk_size;
+            }
+        }
+        vkCmdCopyBuffer(command_buffer, staging_buffer, state_buffers[segment], copy_regions.size(), copy_regions.data());
+        copied.push_back(glm::ivec2(storage_x, storage_z) / chunk_size);
+
+        staged += column_size;
+        *waiting = pending.back();
+        pending.pop_back();
+    }
+
+    if (!deferred.empty()) {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        finished.insert(finished.begin(), std::make_move_iterator(deferred.begin()), std::make_move_iterator(deferred.end()));
+    }
+    if (staged == 0) {
+        return false;
+    }
+    vmaFlushAllocation(device.allocator(), staging_allocation, 0, staged);
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT_KHR | VK_ACCESS_2_SHADER_WRITE_BIT_KHR;
+
+    VkDependencyInfoKHR dep_info{};
+    dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dep_info.memoryBarrierCount = 1;
+    dep_info.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(command_buffer, &dep_info);
+    return true;
+}
+
+}
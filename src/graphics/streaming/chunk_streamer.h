@@ -0,0 +1,92 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "glm/glm.hpp"
+#include "graphics/device/device.h"
+#include "settings/settings.h"
+
+namespace cscd {
+
+// Keeps a window of the world resident around the camera, for worlds that are
+// unbounded along x and z. The window keeps its size (the renderer's world
+// dimensions) and moves a chunk column at a time. The state buffers are
+// addressed toroidally (see state.glslh), so a move only has to rewrite the
+// columns that entered the window, into the slots of the ones that left it.
+//
+// Entering columns are produced by a ColumnProvider on a worker thread, nearest
+// the camera first, and uploaded at the start of a frame under a byte budget.
+// Until its upload lands a slot still holds the column that left, and edits
+// made to a column are lost once it leaves the window.
+class ChunkStreamer {
+public:
+    static constexpr VkDeviceSize DEFAULT_UPLOAD_BUDGET = 4 * 1024 * 1024;
+
+    // Fills extent voxels starting at origin (world space) into voxels, in z, y, x order.
+    // Only ever called from the streaming worker.
+    using ColumnProvider = std::function<void(glm::ivec3 origin, glm::ivec3 extent, uint8_t* voxels)>;
+
+    // Centres the window on the camera, scene_info's camera is moved into the
+    // window's space. The caller fills the initial window.
+    ChunkStreamer(Device& device_, SceneInfo& scene_info_, std::vector<VkBuffer> state_buffers_, uint32_t state_segment_layers_,
+                  ColumnProvider provider_, VkDeviceSize upload_budget_ = DEFAULT_UPLOAD_BUDGET);
+    ~ChunkStreamer();
+
+    ChunkStreamer(const ChunkStreamer&) = delete;
+    ChunkStreamer& operator=(const ChunkStreamer&) = delete;
+
+    // Recentres the window on the camera, returns true if it moved. Call before scene_info is uploaded.
+    bool update();
+    // Copies finished columns into the world, must be recorded before anything reads the state.
+    // The storage chunk columns copied into are appended to copied, returns true if there were any.
+    bool record(VkCommandBuffer command_buffer, std::vector<glm::ivec2>& copied);
+
+    glm::ivec3 getWindowOrigin() const { return scene_info.window_origin; }
+    size_t getPendingColumns() const { return pending.size(); }
+
+private:
+    struct Column {
+        glm::ivec2 chunk;
+        std::vector<uint8_t> voxels;
+    };
+
+    glm::ivec2 cameraChunk() const;
+    bool inWindow(glm::ivec2 chunk) const;
+    void moveWindow(glm::ivec2 origin_chunk);
+    void workerLoop();
+
+    Device& device;
+    SceneInfo& scene_info;
+    std::vector<VkBuffer> state_buffers;
+    uint32_t state_segment_layers;
+    ColumnProvider provider;
+
+    int chunk_size;
+    glm::ivec3 window_dimensions;
+    glm::ivec2 window_chunks;
+    glm::ivec2 origin_chunk{0};
+    VkDeviceSize column_size;
+
+    VkDeviceSize upload_budget;
+    VkBuffer staging_buffer = VK_NULL_HANDLE;
+    VmaAllocation staging_allocation = VK_NULL_HANDLE;
+    VmaAllocationInfo staging_info{};
+
+    // Columns in the window still waiting for their voxels, main thread only
+    std::vector<glm::ivec2> pending;
+
+    std::thread worker;
+    std::mutex worker_mutex;
+    std::condition_variable worker_cv;
+    std::vector<glm::ivec2> requests;
+    std::vector<Column> finished;
+    glm::ivec2 priority_chunk{0};
+    bool stop_worker = false;
+};
+
+}
@@ -33,7 +33,9 @@ public:
 
     VkResult acquireNextImage(uint32_t *imageIndex);
     void recordImageBarrier(VkCommandBuffer buffer, VkImage& image, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags scrAccess, VkAccessFlags dstAccess, VkPipelineStageFlags srcBind, VkPipelineStageFlags dstBind);
-    VkResult submitCommandBuffers(const VkCommandBuffer *buffers, uint32_t *imageIndex);
+    // Optionally also waits for waitSemaphore before compute and signals signalSemaphore
+    VkResult submitCommandBuffers(const VkCommandBuffer *buffers, uint32_t *imageIndex,
+                                  VkSemaphore waitSemaphore = VK_NULL_HANDLE, VkSemaphore signalSemaphore = VK_NULL_HANDLE);
 
     bool compareSwapFormats(const SwapChain& swap_chain) const {
         return swap_chain.swapChainDepthFormat == swapChainDepthFormat &&
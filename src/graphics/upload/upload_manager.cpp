@@ -0,0 +1,158 @@
+#include <stdexcept>
+#include <algorithm>
+#include "upload_manager.h"
+
+namespace cscd {
+
+UploadManager::UploadManager(Device& device_, VkDeviceSize slice_size_) :
+    device{device_},
+    slice_size{slice_size_}
+{
+    VkCommandBufferAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandPool = device.getCommandPool();
+    alloc_info.commandBufferCount = 1;
+
+    VkFenceCreateInfo fence_info{};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    for (auto& slot : ring) {
+        if (vkAllocateCommandBuffers(device.device(), &alloc_info, &slot.command_buffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate upload command buffer!");
+        }
+        if (vkCreateFence(device.device(), &fence_info, nullptr, &slot.fence) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create upload fence!");
+        }
+    }
+}
+
+UploadManager::~UploadManager() {
+    for (auto& slot : ring) {
+        if (slot.pending_bytes != 0) {
+            vkWaitForFences(device.device(), 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        }
+        vkDestroyFence(device.device(), slot.fence, nullptr);
+        vkFreeCommandBuffers(device.device(), device.getCommandPool(), 1, &slot.command_buffer);
+    }
+    destroyRing();
+}
+
+void UploadManager::createRing(VkDeviceSize buffer_size) {
+    destroyRing();
+
+    VkBufferCreateInfo buffer_create_info{};
+    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.size = buffer_size;
+    buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    VmaAllocationCreateInfo allocation_info{};
+    allocation_info.usage = VMA_MEMORY_USAGE_AUTO;
+    allocation_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    allocation_info.priority = 1.0f;
+
+    for (auto& slot : ring) {
+        VmaAllocationInfo alloc_info;
+        if (vmaCreateBuffer(device.allocator(), &buffer_create_info, &allocation_info, &slot.buffer, &slot.allocation, &alloc_info) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create upload staging buffer!");
+        }
+        slot.mapped = static_cast<uint8_t*>(alloc_info.pMappedData);
+    }
+    ring_buffer_size = buffer_size;
+}
+
+void UploadManager::destroyRing() {
+    for (auto& slot : ring) {
+        if (slot.buffer != VK_NULL_HANDLE) {
+            vmaDestroyBuffer(device.allocator(), slot.buffer, slot.allocation);
+            slot.buffer = VK_NULL_HANDLE;
+            slot.mapped = nullptr;
+        }
+    }
+    ring_buffer_size = 0;
+}
+
+uint64_t UploadManager::retireSlot(Slot& slot) {
+    if (slot.pending_bytes == 0) {
+        return 0;
+    }
+
+    vkWaitForFences(device.device(), 1, &slot.fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(device.device(), 1, &slot.fence);
+
+    uint64_t retired = slot.pending_bytes;
+    slot.pending_bytes = 0;
+    return retired;
+}
+
+void UploadManager::upload(VkBuffer dst_buffer, VkDeviceSize dst_offset, uint64_t size, uint64_t granularity,
+                           const FillCallback& fill, const ProgressCallback& progress) {
+    if (granularity == 0) {
+        throw std::runtime_error("Upload granularity must be non-zero!");
+    }
+
+    uint64_t slice = std::max<uint64_t>(granularity, (slice_size / granularity) * granularity);
+    slice = std::min(slice, size);
+    if (ring_buffer_size < slice) {
+        createRing(slice);
+    }
+
+    uint64_t completed = 0;
+    uint64_t offset = 0;
+    int slot_index = 0;
+    while (offset < size) {
+        Slot& slot = ring[slot_index];
+        uint64_t retired = retireSlot(slot);
+        if (retired != 0) {
+            completed += retired;
+            if (progress) {
+                progress(completed, size);
+            }
+        }
+
+        uint64_t slice_bytes = std::min(slice, size - offset);
+        fill(offset, slice_bytes, slot.mapped);
+        vmaFlushAllocation(device.allocator(), slot.allocation, 0, slice_bytes);
+
+        VkCommandBufferBeginInfo begin_info{};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkResetCommandBuffer(slot.command_buffer, 0);
+        vkBeginCommandBuffer(slot.command_buffer, &begin_info);
+
+        VkBufferCopy copy_region{};
+        copy_region.srcOffset = 0;
+        copy_region.dstOffset = dst_offset + offset;
+        copy_region.size = slice_bytes;
+        vkCmdCopyBuffer(slot.command_buffer, slot.buffer, dst_buffer, 1, &copy_region);
+
+        vkEndCommandBuffer(slot.command_buffer);
+
+        VkSubmitInfo submit_info{};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &slot.command_buffer;
+
+        if (vkQueueSubmit(device.computeQueue(), 1, &submit_info, slot.fence) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to submit upload slice!");
+        }
+        slot.pending_bytes = slice_bytes;
+
+        offset += slice_bytes;
+        slot_index = (slot_index + 1) % RING_SIZE;
+    }
+
+    // Drain in submission order so progress stays monotonic
+    for (int i = 0; i < RING_SIZE; i++) {
+        uint64_t retired = retireSlot(ring[(slot_index + i) % RING_SIZE]);
+        if (retired != 0) {
+            completed += retired;
+            if (progress) {
+                progress(completed, size);
+            }
+        }
+    }
+}
+
+}
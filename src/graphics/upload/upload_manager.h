@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include "graphics/device/device.h"
+
+namespace cscd {
+
+// Streams data into a device local buffer in fixed size slices through a small
+// ring of persistently mapped staging buffers. Filling slice N+1 on the host
+// overlaps the GPU copy of slice N, each slot is tracked by its own fence.
+class UploadManager {
+public:
+    static constexpr int RING_SIZE = 3;
+    static constexpr VkDeviceSize DEFAULT_SLICE_SIZE = 16 * 1024 * 1024;
+
+    // Fills dst with size bytes starting at offset into the upload
+    using FillCallback = std::function<void(uint64_t offset, uint64_t size, uint8_t* dst)>;
+    // Called with the number of bytes the GPU has finished copying
+    using ProgressCallback = std::function<void(uint64_t completed, uint64_t total)>;
+
+    UploadManager(Device& device_, VkDeviceSize slice_size_ = DEFAULT_SLICE_SIZE);
+    ~UploadManager();
+
+    UploadManager(const UploadManager&) = delete;
+    UploadManager& operator=(const UploadManager&) = delete;
+
+    // Every slice but the last is a whole number of granularity sized units (e.g. z-layers)
+    void upload(VkBuffer dst_buffer, VkDeviceSize dst_offset, uint64_t size, uint64_t granularity,
+                const FillCallback& fill, const ProgressCallback& progress = nullptr);
+
+private:
+    struct Slot {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        uint8_t* mapped = nullptr;
+        VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        uint64_t pending_bytes = 0;
+    };
+
+    void createRing(VkDeviceSize buffer_size);
+    void destroyRing();
+    uint64_t retireSlot(Slot& slot);
+
+    Device& device;
+    VkDeviceSize slice_size;
+    VkDeviceSize ring_buffer_size = 0;
+    std::array<Slot, RING_SIZE> ring{};
+};
+
+}
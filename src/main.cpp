@@ -1,8 +1,14 @@
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <random>
+#include <memory>
 #include "graphics/application/application.h"
+#include "graphics/benchmark/physics_benchmark.h"
 #include "files/state_file.h"
+#include "files/generation_cache.h"
 
 void writeExampleState() {
     cscd::file::State world_state{3, 3, 3};
@@ -22,19 +28,153 @@ void writeExampleState() {
     world_state.writeToFile("state.ccst");
 }
 
-void writeExampleStatePerlin() {
-    cscd::file::State world_state{256, 256, 256};
+// The default world, only generated the first time it's asked for
+std::string acquireExampleStatePerlin(const std::string& cache_dir, const cscd::generation::TerrainSettings& terrain) {
+    cscd::file::GenerationKey key{};
+    key.type = cscd::file::GeneratorType::PERLIN_2D;
+    key.terrain = terrain;
+    key.dimensions = glm::uvec3{256, 256, 256};
 
-    world_state.fillPerlin();
-    world_state.writeToFile("state.ccst");
+    cscd::file::GenerationCache cache{cache_dir};
+    return cache.acquire(key);
+}
+
+// Parses world sizes given as XxYxZ, e.g. 256x256x256
+glm::ivec3 parseDimensions(const std::string& text) {
+    glm::ivec3 dimensions{0};
+    if (std::sscanf(text.c_str(), "%dx%dx%d", &dimensions.x, &dimensions.y, &dimensions.z) != 3 ||
+        dimensions.x <= 0 || dimensions.y <= 0 || dimensions.z <= 0) {
+        throw std::runtime_error("Invalid world size " + text + ", expected XxYxZ!");
+    }
+    return dimensions;
+}
+
+cscd::PhysicsKernel parsePhysicsKernel(const std::string& text) {
+    if (text == "serial") {
+        return cscd::PhysicsKernel::SERIAL;
+    } else if (text == "tiled") {
+        return cscd::PhysicsKernel::TILED;
+    } else if (text == "fine") {
+        return cscd::PhysicsKernel::FINE;
+    } else if (text == "margolus") {
+        return cscd::PhysicsKernel::MARGOLUS;
+    }
+    throw std::runtime_error("Unknown physics kernel " + text + ", expected serial, tiled, fine or margolus!");
 }
 
-int main() {
-    writeExampleStatePerlin();
+int main(int argc, char** argv) {
+    std::string record_path;
+    std::string replay_path;
+    uint32_t seed = std::random_device{}();
+    uint32_t hash_interval = 60;
+    glm::ivec3 generate_dimensions{0};
+    glm::ivec3 host_dimensions{0};
+    glm::ivec3 verify_dimensions{0};
+    glm::ivec3 stream_dimensions{0};
+    std::string cache_dir = "cache";
+    std::string physics_kernel;
+    cscd::generation::TerrainSettings terrain{};
+    cscd::BenchmarkSettings benchmark{};
+    for (int i = 1; i < argc; i += 2) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << "\n";
+            return EXIT_FAILURE;
+        }
 
-    cscd::Application app{"state.ccst"};
+        try {
+            if (arg == "--record") {
+                record_path = argv[i + 1];
+            } else if (arg == "--replay") {
+                replay_path = argv[i + 1];
+            } else if (arg == "--seed") {
+                seed = std::stoul(argv[i + 1]);
+            } else if (arg == "--hash-interval") {
+                hash_interval = std::stoul(argv[i + 1]);
+            } else if (arg == "--generate") {
+                generate_dimensions = parseDimensions(argv[i + 1]);
+            } else if (arg == "--generate-host") {
+                host_dimensions = parseDimensions(argv[i + 1]);
+            } else if (arg == "--stream") {
+                stream_dimensions = parseDimensions(argv[i + 1]);
+            } else if (arg == "--verify-generation") {
+                verify_dimensions = parseDimensions(argv[i + 1]);
+            } else if (arg == "--cache-dir") {
+                cache_dir = argv[i + 1];
+            } else if (arg == "--physics") {
+                physics_kernel = argv[i + 1];
+            } else if (arg == "--terrain-seed") {
+                terrain.seed = std::stoi(argv[i + 1]);
+            } else if (arg == "--headless") {
+                benchmark.state_path = argv[i + 1];
+            } else if (arg == "--steps") {
+                benchmark.steps = std::stoul(argv[i + 1]);
+            } else if (arg == "--output") {
+                benchmark.output_path = argv[i + 1];
+            } else {
+                std::cerr << "Unknown argument " << arg << "\n";
+                return EXIT_FAILURE;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Invalid value " << argv[i + 1] << " for " << arg << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // cpu only picks a backend for the headless benchmark
+    bool cpu_physics = physics_kernel == "cpu" && !benchmark.state_path.empty();
+    if (!physics_kernel.empty() && !cpu_physics) {
+        try {
+            benchmark.kernel = parsePhysicsKernel(physics_kernel);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Physics only, no window, on a headless device or the CPU with --physics cpu
+    if (!benchmark.state_path.empty()) {
+        benchmark.seed = seed;
+        benchmark.cpu = cpu_physics;
+        try {
+            cscd::PhysicsBenchmark{benchmark}.run();
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (verify_dimensions.x != 0) {
+        cscd::Application app{verify_dimensions, terrain};
+        return app.verifyTerrain(terrain) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::unique_ptr<cscd::Application> app_ptr;
+    if (stream_dimensions.x != 0) {
+        app_ptr = std::make_unique<cscd::Application>(stream_dimensions, terrain, true);
+    } else if (host_dimensions.x != 0) {
+        // Generated on the CPU and moved straight into the renderer
+        cscd::file::State world_state{(uint32_t)host_dimensions.x, (uint32_t)host_dimensions.y, (uint32_t)host_dimensions.z};
+        world_state.generator.settings = terrain;
+        world_state.fillPerlin();
+        app_ptr = std::make_unique<cscd::Application>(std::move(world_state));
+    } else if (generate_dimensions.x != 0) {
+        app_ptr = std::make_unique<cscd::Application>(generate_dimensions, terrain);
+    } else {
+        app_ptr = std::make_unique<cscd::Application>(acquireExampleStatePerlin(cache_dir, terrain));
+    }
+    cscd::Application& app = *app_ptr;
+    if (!physics_kernel.empty()) {
+        app.setPhysicsKernel(benchmark.kernel);
+    }
 
     try {
+        if (!replay_path.empty()) {
+            app.replayJournal(replay_path);
+        } else if (!record_path.empty()) {
+            app.recordJournal(record_path, seed, hash_interval);
+        }
         app.run();
     } catch (const std::exception& e) {
         std::cerr << e.what() << "\n";
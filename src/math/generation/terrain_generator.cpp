@@ -1,51 +1,160 @@
+#include <vector>
+#include <cstring>
+#include <algorithm>
 #include "terrain_generator.h"
 #include "physics/particles/particle_types.h"
 
 namespace cscd {
 namespace generation {
 
+    float fractalBounding(int octaves) {
+        float gain = 0.5f;
+        float amp = gain;
+        float amp_fractal = 1.0f;
+        for (int i = 1; i < octaves; i++) {
+            amp_fractal += amp;
+            amp *= gain;
+        }
+        return 1.0f / amp_fractal;
+    }
+
     int TerrainGenerator::mapNoiseToHeight(float value, int terrain_min, int terrain_max) {
         return terrain_min + value * (terrain_max - terrain_min);
     }
 
-    void TerrainGenerator::generatePerlin2D(uint8_t* grid, int x_size, int y_size, int z_size) {
+    void TerrainGenerator::configurePerlin() {
+        noise.SetSeed(settings.seed);
+        noise.SetFrequency(settings.frequency);
         noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
         noise.SetFractalType(FastNoiseLite::FractalType_FBm);
-        noise.SetFractalOctaves(6);
+        noise.SetFractalOctaves(settings.octaves);
+    }
 
+    void TerrainGenerator::sampleRow(const FastNoiseLite& row_noise, glm::ivec2 begin, int x_size, float* values) {
         for (int x = 0; x < x_size; x++) {
-            for (int z = 0; z < z_size; z++) {
-                float terrain_ratio = (1.0f / 2.0f);
-                int terrain_min = (terrain_ratio / 2.0f) * y_size;
-                int terrain_max = (1.0f - (terrain_ratio / 2.0f)) * y_size;
-                int height = mapNoiseToHeight(noise.GetNoise<float>(x, z), terrain_min, terrain_max);
-                for (int y = 0; y < y_size; y++) {
-                    int grid_index = z * x_size * y_size + y * x_size + x;
-                    if (y < height) {
-                        grid[grid_index] = (uint8_t)cscd::physics::ParticleType::SAND;
-                    } else {
-                        grid[grid_index] = (uint8_t)cscd::physics::ParticleType::EMPTY;
-                    }
-                }
-            }
+            values[x] = row_noise.GetNoise<float>(begin.x + x, begin.y);
         }
     }
 
-    void TerrainGenerator::generatePerlin3D(uint8_t* grid, int x_size, int y_size, int z_size) {
-        noise.SetNoiseType(FastNoiseLite::NoiseType_Perlin);
-        noise.SetFractalType(FastNoiseLite::FractalType_FBm);
-        noise.SetFractalOctaves(6);
+    void TerrainGenerator::sampleRow(const FastNoiseLite& row_noise, glm::ivec3 begin, int x_size, float* values) {
+        for (int x = 0; x < x_size; x++) {
+            values[x] = row_noise.GetNoise<float>(begin.x + x, begin.y, begin.z);
+        }
+    }
 
+    void TerrainGenerator::fillHeightmapLayer(const FastNoiseLite& layer_noise, uint8_t* layer, glm::ivec3 origin, int x_size, int y_size,
+                                              int terrain_min, int terrain_max, float* samples, int* heights) {
+        sampleRow(layer_noise, glm::ivec2(origin.x, origin.z), x_size, samples);
         for (int x = 0; x < x_size; x++) {
+            heights[x] = mapNoiseToHeight(samples[x], terrain_min, terrain_max);
+        }
+        fillHeightmapColumns(layer, heights, origin.y, x_size, y_size);
+    }
+
+    void TerrainGenerator::fillHeightmapColumns(uint8_t* layer, const int* heights, int origin_y, int x_size, int y_size) {
+        const uint8_t sand = (uint8_t)cscd::physics::ParticleType::SAND;
+        const uint8_t empty = (uint8_t)cscd::physics::ParticleType::EMPTY;
+
+        // Heights are made relative to the first row of the layer
+        int min_height = y_size;
+        int max_height = 0;
+        for (int x = 0; x < x_size; x++) {
+            min_height = std::min(min_height, heights[x] - origin_y);
+            max_height = std::max(max_height, heights[x] - origin_y);
+        }
+        min_height = std::clamp(min_height, 0, y_size);
+        max_height = std::clamp(max_height, min_height, y_size);
+
+        // Rows below the lowest column are all sand and rows above the
+        // highest all empty, only the rows in between need a per voxel select
+        std::memset(layer, sand, (size_t)min_height * x_size);
+        for (int y = min_height; y < max_height; y++) {
+            uint8_t* row = layer + (size_t)y * x_size;
+            for (int x = 0; x < x_size; x++) {
+                row[x] = y + origin_y < heights[x] ? sand : empty;
+            }
+        }
+        std::memset(layer + (size_t)max_height * x_size, empty, (size_t)(y_size - max_height) * x_size);
+    }
+
+    void TerrainGenerator::generatePerlin2D(uint8_t* grid, int x_size, int y_size, int z_size, ThreadPool& pool) {
+        configurePerlin();
+        std::vector<FastNoiseLite> noises(pool.getThreadCount(), noise);
+        std::vector<std::vector<float>> samples(pool.getThreadCount(), std::vector<float>(x_size));
+        std::vector<std::vector<int>> heights(pool.getThreadCount(), std::vector<int>(x_size));
+
+        float terrain_ratio = settings.terrain_ratio;
+        int terrain_min = (terrain_ratio / 2.0f) * y_size;
+        int terrain_max = (1.0f - (terrain_ratio / 2.0f)) * y_size;
+
+        pool.parallelFor(z_size, [&](uint32_t z, unsigned worker) {
+            fillHeightmapLayer(noises[worker], grid + (size_t)z * x_size * y_size, glm::ivec3(0, 0, z), x_size, y_size,
+                               terrain_min, terrain_max, samples[worker].data(), heights[worker].data());
+        });
+    }
+
+    void TerrainGenerator::generatePerlin2DRegion(uint8_t* grid, glm::ivec3 origin, glm::ivec3 extent, int world_height) {
+        std::vector<int> heights((size_t)extent.x * extent.z);
+        samplePerlin2DHeights(heights.data(), origin, extent, world_height);
+        fillPerlin2DRegion(grid, heights.data(), origin, extent);
+    }
+
+    void TerrainGenerator::samplePerlin2DHeights(int* heights, glm::ivec3 origin, glm::ivec3 extent, int world_height) {
+        configurePerlin();
+        std::vector<float> samples(extent.x);
+
+        float terrain_ratio = settings.terrain_ratio;
+        int terrain_min = (terrain_ratio / 2.0f) * world_height;
+        int terrain_max = (1.0f - (terrain_ratio / 2.0f)) * world_height;
+
+        for (int z = 0; z < extent.z; z++) {
+            sampleRow(noise, glm::ivec2(origin.x, origin.z + z), extent.x, samples.data());
+            int* row = heights + (size_t)z * extent.x;
+            for (int x = 0; x < extent.x; x++) {
+                row[x] = mapNoiseToHeight(samples[x], terrain_min, terrain_max);
+            }
+        }
+    }
+
+    void TerrainGenerator::fillPerlin2DRegion(uint8_t* grid, const int* heights, glm::ivec3 origin, glm::ivec3 extent) {
+        for (int z = 0; z < extent.z; z++) {
+            fillHeightmapColumns(grid + (size_t)z * extent.x * extent.y, heights + (size_t)z * extent.x, origin.y, extent.x, extent.y);
+        }
+    }
+
+    void TerrainGenerator::generatePerlin3D(uint8_t* grid, int x_size, int y_size, int z_size, ThreadPool& pool) {
+        configurePerlin();
+        std::vector<FastNoiseLite> noises(pool.getThreadCount(), noise);
+        std::vector<std::vector<float>> samples(pool.getThreadCount(), std::vector<float>(x_size));
+
+        const uint8_t sand = (uint8_t)cscd::physics::ParticleType::SAND;
+        const uint8_t empty = (uint8_t)cscd::physics::ParticleType::EMPTY;
+
+        pool.parallelFor(z_size, [&](uint32_t z, unsigned worker) {
+            float* densities = samples[worker].data();
             for (int y = 0; y < y_size; y++) {
-                for (int z = 0; z < z_size; z++) {
-                    float density = noise.GetNoise<float>(x, y, z);
-                    int grid_index = z * x_size * y_size + y * x_size + x;
-                    if (density >= 0) {
-                        grid[grid_index] = (uint8_t)cscd::physics::ParticleType::SAND;
-                    } else {
-                        grid[grid_index] = (uint8_t)cscd::physics::ParticleType::EMPTY;
-                    }
+                sampleRow(noises[worker], glm::ivec3(0, y, z), x_size, densities);
+                uint8_t* row = grid + (size_t)z * x_size * y_size + (size_t)y * x_size;
+                for (int x = 0; x < x_size; x++) {
+                    row[x] = densities[x] >= 0 ? sand : empty;
+                }
+            }
+        });
+    }
+
+    void TerrainGenerator::generatePerlin3DRegion(uint8_t* grid, glm::ivec3 origin, glm::ivec3 extent) {
+        configurePerlin();
+        std::vector<float> densities(extent.x);
+
+        const uint8_t sand = (uint8_t)cscd::physics::ParticleType::SAND;
+        const uint8_t empty = (uint8_t)cscd::physics::ParticleType::EMPTY;
+
+        for (int z = 0; z < extent.z; z++) {
+            for (int y = 0; y < extent.y; y++) {
+                sampleRow(noise, origin + glm::ivec3(0, y, z), extent.x, densities.data());
+                uint8_t* row = grid + ((size_t)z * extent.y + y) * extent.x;
+                for (int x = 0; x < extent.x; x++) {
+                    row[x] = densities[x] >= 0 ? sand : empty;
                 }
             }
         }
@@ -1,18 +1,60 @@
+#pragma once
+
+#include <stddef.h>
 #include <stdint.h>
 #include <externals/FastNoiseLite/FastNoiseLite.h>
+#include "glm/glm.hpp"
+#include "threading/thread_pool.h"
 
 namespace cscd {
 namespace generation {
 
+// Lacunarity and gain are left at FastNoiseLite's defaults of 2 and 0.5
+struct TerrainSettings {
+    int seed = 1337;
+    int octaves = 6;
+    float terrain_ratio = 1.0f / 2.0f;
+    float frequency = 0.01f;
+};
+
+// 1 / the summed amplitude of every octave, as FastNoiseLite scales FBm
+float fractalBounding(int octaves);
+
+// Generation is split into z layers across the pool. noise only holds the
+// settings, each worker samples from its own copy of it, so the output is the
+// same for any number of threads. Layers are written in storage order, noise
+// is sampled a row at a time and voxels are filled a row at a time from it.
 class TerrainGenerator {
 private:
     FastNoiseLite noise{};
 
+    void configurePerlin();
+    // Samples noise at x = [begin.x, begin.x + x_size) along the row y = begin.y into values
+    static void sampleRow(const FastNoiseLite& row_noise, glm::ivec2 begin, int x_size, float* values);
+    static void sampleRow(const FastNoiseLite& row_noise, glm::ivec3 begin, int x_size, float* values);
+    // Fills one z layer of the heightmap terrain, origin is the layer's first voxel in world space
+    void fillHeightmapLayer(const FastNoiseLite& layer_noise, uint8_t* layer, glm::ivec3 origin, int x_size, int y_size,
+                            int terrain_min, int terrain_max, float* samples, int* heights);
+    // Fills one z layer from the world space heights of its x_size columns, layer starts at row origin_y
+    static void fillHeightmapColumns(uint8_t* layer, const int* heights, int origin_y, int x_size, int y_size);
+
 public:
+    TerrainSettings settings{};
+
     int mapNoiseToHeight(float value, int terrain_min, int terrain_max);
 
-    void generatePerlin2D(uint8_t* grid, int x_size, int y_size, int z_size);
-    void generatePerlin3D(uint8_t* grid, int x_size, int y_size, int z_size);
+    void generatePerlin2D(uint8_t* grid, int x_size, int y_size, int z_size, ThreadPool& pool = sharedThreadPool());
+    // Fills extent voxels of the same terrain starting at origin, as if the world
+    // were world_height voxels tall and unbounded along x and z. Runs on the
+    // calling thread.
+    void generatePerlin2DRegion(uint8_t* grid, glm::ivec3 origin, glm::ivec3 extent, int world_height);
+    // The two halves of generatePerlin2DRegion, so regions stacked along y can
+    // share one sampling of their footprint. heights holds extent.x * extent.z
+    // values, x first, and only origin.xz and extent.xz are used.
+    void samplePerlin2DHeights(int* heights, glm::ivec3 origin, glm::ivec3 extent, int world_height);
+    static void fillPerlin2DRegion(uint8_t* grid, const int* heights, glm::ivec3 origin, glm::ivec3 extent);
+    void generatePerlin3D(uint8_t* grid, int x_size, int y_size, int z_size, ThreadPool& pool = sharedThreadPool());
+    void generatePerlin3DRegion(uint8_t* grid, glm::ivec3 origin, glm::ivec3 extent);
 };
 
 }
@@ -2,8 +2,18 @@
 
 typedef std::mt19937 rng_type;
 
-int Rand::range(int min, int max) {
+static std::minstd_rand& generator() {
     static std::minstd_rand gen(std::random_device{}());
-    std::uniform_int_distribution<std::minstd_rand::result_type> dist(min,max);
-    return dist(gen);
+    return gen;
+}
+
+void Rand::seed(uint32_t seed) {
+    generator().seed(seed);
+}
+
+int Rand::range(int min, int max) {
+    // minstd_rand is fully specified by the standard, uniform_int_distribution
+    // isn't, so map onto the range by hand to stay reproducible across toolchains
+    uint32_t span = (uint32_t)(max - min) + 1;
+    return min + (int)(generator()() % span);
 }
\ No newline at end of file
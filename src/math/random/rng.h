@@ -1,6 +1,9 @@
 #pragma once
 #include <random>
+#include <stdint.h>
 
 namespace Rand {
+    // Restarts the stream, the same seed always produces the same sequence of ranges
+    void seed(uint32_t seed);
     int range(int min, int max);
 }
\ No newline at end of file
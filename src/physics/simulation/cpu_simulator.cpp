@@ -0,0 +1,292 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include "cpu_simulator.h"
+#include "math/random/rng.h"
+#include "physics/particles/particle_types.h"
+
+// Cells handed to a worker at a time
+#define CPU_PHYSICS_CELL_BATCH 64
+
+namespace cscd {
+namespace physics {
+
+// The move tables from evolveVoxel in physics_rules.glslh, tried in order
+static const glm::ivec3 sand_moves[] = {
+    glm::ivec3(0, -1, 0),
+    glm::ivec3(1, -1, 0),
+    glm::ivec3(-1, -1, 0),
+    glm::ivec3(0, -1, 1),
+    glm::ivec3(0, -1, -1),
+    glm::ivec3(-1, -1, -1),
+    glm::ivec3(1, -1, 1),
+    glm::ivec3(1, -1, -1),
+    glm::ivec3(-1, -1, 1)
+};
+
+static const glm::ivec3 dirt_moves[] = {
+    glm::ivec3(0, -1, 0)
+};
+
+static const glm::ivec3 water_moves[] = {
+    glm::ivec3(0, -1, 0),
+    glm::ivec3(1, -1, 0),
+    glm::ivec3(-1, -1, 0),
+    glm::ivec3(0, -1, 1),
+    glm::ivec3(0, -1, -1),
+    glm::ivec3(-1, -1, -1),
+    glm::ivec3(1, -1, 1),
+    glm::ivec3(1, -1, -1),
+    glm::ivec3(-1, -1, 1),
+    glm::ivec3(1, 0, 0),
+    glm::ivec3(-1, 0, 0),
+    glm::ivec3(0, 0, 1),
+    glm::ivec3(0, 0, -1),
+    glm::ivec3(-1, 0, -1),
+    glm::ivec3(1, 0, 1),
+    glm::ivec3(1, 0, -1),
+    glm::ivec3(-1, 0, 1)
+};
+
+// The subchunk each pass evolves, in the order Renderer::recordSubchunkPasses runs them
+static const glm::ivec3 subchunk_locations[8] = {
+    glm::ivec3(0, 0, 0),
+    glm::ivec3(1, 0, 0),
+    glm::ivec3(0, 0, 1),
+    glm::ivec3(1, 0, 1),
+    glm::ivec3(0, 1, 0),
+    glm::ivec3(1, 1, 0),
+    glm::ivec3(0, 1, 1),
+    glm::ivec3(1, 1, 1)
+};
+
+// First voxel in [x, end) of a row that isn't air, or end. Tests 8 voxels at a
+// time, which covers a whole subchunk row.
+static int skipAir(const uint8_t* row, int x, int end) {
+    while (end - x >= 8) {
+        uint64_t word;
+        std::memcpy(&word, row + x, sizeof(word));
+        if (word != 0) {
+            break;
+        }
+        x += 8;
+    }
+    while (x < end && row[x] == 0) {
+        x++;
+    }
+    return x;
+}
+
+CpuSimulator::CpuSimulator(file::State& state_, int idle_frames_, ThreadPool& pool_) :
+    state{state_},
+    pool{pool_},
+    idle_frames{std::max(idle_frames_, 1)}
+{
+    if (state.isPacked()) {
+        throw std::runtime_error("CPU physics needs an unpacked state!");
+    }
+    if (state.getSize() == 0) {
+        throw std::runtime_error("World contains no voxels!");
+    }
+
+    voxels = state.data.data();
+    world_dimensions = state.getDimensions();
+    num_chunks = (world_dimensions + CPU_PHYSICS_CHUNK_SIZE - 1) / CPU_PHYSICS_CHUNK_SIZE;
+    // A physics cell per chunk plus one more along each axis, as in Renderer::createSubchunkStateBuffer
+    num_cells = num_chunks + 1;
+
+    size_t chunk_count = (size_t)num_chunks.x * num_chunks.y * num_chunks.z;
+    chunk_activity = std::make_unique<std::atomic<uint32_t>[]>(chunk_count);
+    chunk_awake.resize(chunk_count, 0);
+}
+
+bool CpuSimulator::inWorld(glm::ivec3 loc) const {
+    return glm::all(glm::greaterThanEqual(loc, glm::ivec3(0))) && glm::all(glm::lessThan(loc, world_dimensions));
+}
+
+size_t CpuSimulator::voxelIndex(glm::ivec3 loc) const {
+    return ((size_t)loc.z * world_dimensions.y + loc.y) * world_dimensions.x + loc.x;
+}
+
+uint8_t CpuSimulator::getVoxel(glm::ivec3 loc) const {
+    if (inWorld(loc)) {
+        return voxels[voxelIndex(loc)];
+    }
+    return 255;
+}
+
+void CpuSimulator::setVoxel(glm::ivec3 loc, uint8_t value) {
+    if (inWorld(loc)) {
+        voxels[voxelIndex(loc)] = value;
+        wakeChunksAround(loc);
+    }
+}
+
+int CpuSimulator::chunkIndex(glm::ivec3 chunk) const {
+    return chunk.z * num_chunks.y * num_chunks.x + chunk.y * num_chunks.x + chunk.x;
+}
+
+bool CpuSimulator::chunkAwake(int index) const {
+    return frame - chunk_activity[index].load(std::memory_order_relaxed) < (uint32_t)idle_frames;
+}
+
+// Same chunks as wakeChunksAround in sleep.glslh
+void CpuSimulator::wakeChunksAround(glm::ivec3 loc) {
+    glm::ivec3 chunk = loc / CPU_PHYSICS_CHUNK_SIZE;
+    glm::ivec3 local = loc - chunk * CPU_PHYSICS_CHUNK_SIZE;
+
+    glm::ivec3 toward = glm::ivec3(glm::equal(local, glm::ivec3(CPU_PHYSICS_CHUNK_SIZE - 1))) - glm::ivec3(glm::equal(local, glm::ivec3(0)));
+    toward = glm::clamp(chunk + toward, glm::ivec3(0), num_chunks - 1) - chunk;
+
+    for (int z = 0; z <= std::abs(toward.z); z++) {
+        for (int y = 0; y <= std::abs(toward.y); y++) {
+            for (int x = 0; x <= std::abs(toward.x); x++) {
+                std::atomic<uint32_t>& activity = chunk_activity[chunkIndex(chunk + glm::ivec3(x, y, z) * toward)];
+                uint32_t seen = activity.load(std::memory_order_relaxed);
+                while (seen < frame && !activity.compare_exchange_weak(seen, frame, std::memory_order_relaxed)) {}
+            }
+        }
+    }
+}
+
+void CpuSimulator::edit(glm::ivec3 location, uint8_t value) {
+    if (!inWorld(location)) {
+        return;
+    }
+    voxels[voxelIndex(location)] = value;
+    wakeChunksAround(location);
+}
+
+// Mirrors compact.comp: updates the sleep counters and lists the cells over an awake chunk
+void CpuSimulator::compactActiveCells() {
+    size_t chunk_count = chunk_awake.size();
+    if (wake_all_chunks) {
+        for (size_t i = 0; i < chunk_count; i++) {
+            chunk_activity[i].store(frame, std::memory_order_relaxed);
+        }
+        wake_all_chunks = false;
+    }
+
+    counters = PhysicsCounters{};
+    for (size_t i = 0; i < chunk_count; i++) {
+        uint8_t awake = chunkAwake(i);
+        if (awake && !chunk_awake[i]) {
+            counters.woken_chunks++;
+        } else if (!awake && chunk_awake[i]) {
+            counters.slept_chunks++;
+        }
+        if (awake) {
+            counters.awake_chunks++;
+        }
+        chunk_awake[i] = awake;
+    }
+
+    active_cells.clear();
+    for (int z = 0; z < num_cells.z; z++) {
+        for (int y = 0; y < num_cells.y; y++) {
+            for (int x = 0; x < num_cells.x; x++) {
+                glm::ivec3 cell(x, y, z);
+                glm::ivec3 first = glm::max(cell - 1, glm::ivec3(0));
+                glm::ivec3 last = glm::min(cell, num_chunks - 1);
+                bool awake = false;
+                for (int cz = first.z; cz <= last.z && !awake; cz++) {
+                    for (int cy = first.y; cy <= last.y && !awake; cy++) {
+                        for (int cx = first.x; cx <= last.x && !awake; cx++) {
+                            awake = chunk_awake[chunkIndex(glm::ivec3(cx, cy, cz))];
+                        }
+                    }
+                }
+                if (awake) {
+                    active_cells.push_back((z * num_cells.y + y) * num_cells.x + x);
+                }
+            }
+        }
+    }
+    counters.active_cells = active_cells.size();
+}
+
+int CpuSimulator::evolveVoxel(glm::ivec3 loc) {
+    uint8_t voxel_curr = voxels[voxelIndex(loc)];
+    const glm::ivec3* moves;
+    int move_count;
+    switch (voxel_curr) {
+    case (uint8_t)ParticleType::SAND:
+        moves = sand_moves;
+        move_count = sizeof(sand_moves) / sizeof(sand_moves[0]);
+        break;
+    case (uint8_t)ParticleType::DIRT:
+        moves = dirt_moves;
+        move_count = sizeof(dirt_moves) / sizeof(dirt_moves[0]);
+        break;
+    case (uint8_t)ParticleType::WATER:
+        moves = water_moves;
+        move_count = sizeof(water_moves) / sizeof(water_moves[0]);
+        break;
+    default:
+        return 0;
+    }
+
+    for (int i = 0; i < move_count; i++) {
+        if (getVoxel(loc + moves[i]) == 0) {
+            setVoxel(loc + moves[i], voxel_curr);
+            setVoxel(loc, 0);
+            return 2;
+        }
+    }
+    return 0;
+}
+
+// Serially in y, z, x order like evolveSubchunk, so later voxels see the moves of earlier ones
+uint32_t CpuSimulator::evolveSubchunk(glm::ivec3 origin) {
+    int x_begin = std::max(origin.x, 0);
+    int x_end = std::min(origin.x + CPU_PHYSICS_SUBCHUNK_SIZE, world_dimensions.x);
+    if (x_begin >= x_end) {
+        return 0;
+    }
+
+    uint32_t writes = 0;
+    for (int y = origin.y; y < origin.y + CPU_PHYSICS_SUBCHUNK_SIZE; y++) {
+        if (y < 0 || y >= world_dimensions.y) {
+            continue;
+        }
+        for (int z = origin.z; z < origin.z + CPU_PHYSICS_SUBCHUNK_SIZE; z++) {
+            if (z < 0 || z >= world_dimensions.z) {
+                continue;
+            }
+            const uint8_t* row = voxels + voxelIndex(glm::ivec3(0, y, z));
+            for (int x = skipAir(row, x_begin, x_end); x < x_end; x = skipAir(row, x + 1, x_end)) {
+                writes += evolveVoxel(glm::ivec3(x, y, z));
+            }
+        }
+    }
+    return writes;
+}
+
+void CpuSimulator::step() {
+    compactActiveCells();
+
+    uint32_t cell_count = active_cells.size();
+    uint32_t batch_count = (cell_count + CPU_PHYSICS_CELL_BATCH - 1) / CPU_PHYSICS_CELL_BATCH;
+    std::atomic<uint64_t> writes{0};
+    for (int pass = 0; pass < 8; pass++) {
+        int rand_offset = Rand::range(0, CPU_PHYSICS_CHUNK_SIZE - 1);
+        glm::ivec3 subchunk_offset = subchunk_locations[pass] * CPU_PHYSICS_SUBCHUNK_SIZE - glm::ivec3(rand_offset);
+
+        pool.parallelFor(batch_count, [&](uint32_t batch, unsigned) {
+            uint32_t batch_writes = 0;
+            uint32_t end = std::min(cell_count, (batch + 1) * CPU_PHYSICS_CELL_BATCH);
+            for (uint32_t i = batch * CPU_PHYSICS_CELL_BATCH; i < end; i++) {
+                uint32_t cell_index = active_cells[i];
+                glm::ivec3 cell(cell_index % num_cells.x, (cell_index / num_cells.x) % num_cells.y, cell_index / (num_cells.x * num_cells.y));
+                batch_writes += evolveSubchunk(cell * CPU_PHYSICS_CHUNK_SIZE + subchunk_offset);
+            }
+            writes.fetch_add(batch_writes, std::memory_order_relaxed);
+        });
+    }
+
+    voxel_writes = writes;
+    frame++;
+}
+
+}
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include "glm/glm.hpp"
+#include "files/state_file.h"
+#include "settings/settings.h"
+#include "threading/thread_pool.h"
+
+// Must match chunk_size in physics.comp and SceneInfo::chunk_size
+#define CPU_PHYSICS_CHUNK_SIZE 16
+#define CPU_PHYSICS_SUBCHUNK_SIZE (CPU_PHYSICS_CHUNK_SIZE / 2)
+
+namespace cscd {
+namespace physics {
+
+// Runs physics.comp's rules and pass schedule over a State on the CPU, along
+// with the chunk sleeping done by compact.comp. Given the same Rand seed, a
+// step matches a tick of the SERIAL kernel voxel for voxel (and TILED, which
+// evolves the same way).
+//
+// A pass runs every active cell in parallel, which is safe for the same reason
+// it is on the GPU: the subchunks a pass evolves are a subchunk apart, and a
+// voxel only ever reaches its direct neighbours.
+class CpuSimulator {
+public:
+    // state must be unpacked and outlive the simulator
+    CpuSimulator(file::State& state_, int idle_frames_ = RendererSettings{}.physics_idle_frames, ThreadPool& pool_ = sharedThreadPool());
+
+    CpuSimulator(const CpuSimulator&) = delete;
+    CpuSimulator& operator=(const CpuSimulator&) = delete;
+
+    // Written straight away, wakes the chunks around it like EditQueue's edits
+    void edit(glm::ivec3 location, uint8_t value);
+    // Runs physics over every chunk next step, for when the state changed behind its back
+    void wakeAllChunks() { wake_all_chunks = true; }
+
+    // One physics tick, the 8 subchunk passes with offsets drawn from Rand in
+    // the order Renderer::recordSubchunkPasses draws them
+    void step();
+
+    uint32_t getFrame() const { return frame; }
+    // Counters from the last step, as compaction fills them in on the GPU
+    const PhysicsCounters& getCounters() const { return counters; }
+    // Voxels written by the last step, a move writes two
+    uint64_t getVoxelWrites() const { return voxel_writes; }
+
+private:
+    uint8_t getVoxel(glm::ivec3 loc) const;
+    void setVoxel(glm::ivec3 loc, uint8_t value);
+    bool inWorld(glm::ivec3 loc) const;
+    size_t voxelIndex(glm::ivec3 loc) const;
+    int chunkIndex(glm::ivec3 chunk) const;
+    bool chunkAwake(int index) const;
+    void wakeChunksAround(glm::ivec3 loc);
+
+    void compactActiveCells();
+    // Both return the number of voxels written
+    int evolveVoxel(glm::ivec3 loc);
+    uint32_t evolveSubchunk(glm::ivec3 origin);
+
+    file::State& state;
+    ThreadPool& pool;
+    uint8_t* voxels;
+    glm::ivec3 world_dimensions;
+    glm::ivec3 num_chunks;
+    glm::ivec3 num_cells;
+    int idle_frames;
+
+    // Last frame each chunk was written in, and whether it was awake last step
+    std::unique_ptr<std::atomic<uint32_t>[]> chunk_activity;
+    std::vector<uint8_t> chunk_awake;
+    std::vector<uint32_t> active_cells;
+    bool wake_all_chunks = true;
+
+    uint32_t frame = 1;
+    PhysicsCounters counters{};
+    uint64_t voxel_writes = 0;
+};
+
+}
+}
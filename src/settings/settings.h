@@ -2,6 +2,7 @@
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 
+#include <string>
 #include "glm/glm.hpp"
 #include "glm/gtc/constants.hpp"
 
@@ -18,10 +19,34 @@ struct SceneInfo {
 
     alignas(4) int chunk_size = 16;
     alignas(4) int local_size = 8;
+    alignas(4) int state_segment_layers = 0;
+
+    // Streamed worlds only hold a window of the world. window_origin is the
+    // window's first voxel in world space, window_offset where that voxel sits
+    // in the toroidally addressed state buffers. Both are zero otherwise.
+    alignas(16) glm::ivec3 window_origin{0};
+    alignas(16) glm::ivec3 window_offset{0};
+};
+
+enum class PhysicsKernel {
+    SERIAL, // physics.comp, a subchunk per invocation
+    TILED,  // physics_tiled.comp, the same out of shared memory
+    FINE,    // physics_fine.comp, a 2x2x2 block per invocation
+    MARGOLUS // margolus.comp, alternating 2x2x2 blocks with a rule table, deterministic
 };
 
 struct RendererSettings {
     int denoise_iterations = 3;
+    // Frames a chunk stays awake after it was last woken. A pass only covers
+    // half of a cell's voxels, so one quiet frame isn't enough to sleep on.
+    int physics_idle_frames = 8;
+    // Falls back to SERIAL where the device can't run the chosen kernel
+    PhysicsKernel physics_kernel = PhysicsKernel::TILED;
+    float physics_rate = 60.0f; // Physics ticks per second, 0 runs one tick per rendered frame
+    int max_physics_substeps = 4; // Ticks a frame may run before the simulation falls behind real time
+    float render_rate = 0.0f; // Rendered frames per second, 0 leaves it uncapped
+    float snapshot_interval = 0.0f; // Seconds between background snapshots, 0 disables them
+    std::string snapshot_directory = "snapshots";
 };
 
 struct RaytraceSettingsPushConstant {
@@ -37,6 +62,42 @@ struct RaytraceSettingsPushConstant {
 struct PhysicsPushConstant {
     glm::ivec3 subchunk_offset;
     alignas(16) glm::ivec3 subchunk_location;
+    alignas(4) uint32_t frame = 0;
+};
+
+struct MargolusPushConstant {
+    int block_offset = 0;
+    alignas(4) uint32_t frame = 0;
+};
+
+struct PublishPushConstant {
+    uint32_t publish_from = 0;
+};
+
+struct OccupancyPushConstant {
+    glm::ivec3 first; // In words along x
+    alignas(16) glm::ivec3 count;
+};
+
+struct CompactPushConstant {
+    uint32_t frame = 0;
+    alignas(4) uint32_t idle_frames = 0;
+};
+
+// Filled in by compaction each frame, read back with a frame of latency
+struct PhysicsCounters {
+    uint32_t active_cells = 0;
+    uint32_t awake_chunks = 0;
+    uint32_t woken_chunks = 0; // Since the frame before
+    uint32_t slept_chunks = 0; // Since the frame before
+};
+
+struct GeneratePushConstant {
+    int seed = 1337;
+    alignas(4) int octaves = 6;
+    alignas(4) float terrain_ratio = 0.5f;
+    alignas(4) float frequency = 0.01f;
+    alignas(4) float fractal_bounding = 1.0f; // Worked out on the host so it rounds exactly as it does on the CPU
 };
 
 struct PostProcessingPushConstant {
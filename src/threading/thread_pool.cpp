@@ -0,0 +1,88 @@
+#include <algorithm>
+#include "thread_pool.h"
+
+namespace cscd {
+
+ThreadPool::ThreadPool(unsigned thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned i = 0; i < thread_count; i++) {
+        workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t count, const Task& task_) {
+    if (count == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> call_lock(call_mutex);
+    std::unique_lock<std::mutex> lock(mutex);
+    task = &task_;
+    task_count = count;
+    next_index = 0;
+    active_workers = workers.size();
+    error = nullptr;
+    generation++;
+    wake.notify_all();
+
+    finished.wait(lock, [this]() { return active_workers == 0; });
+    task = nullptr;
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::workerLoop(unsigned worker) {
+    uint64_t seen_generation = 0;
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]() { return stopping || generation != seen_generation; });
+        if (stopping) {
+            return;
+        }
+        seen_generation = generation;
+        lock.unlock();
+
+        uint32_t index;
+        while ((index = next_index.fetch_add(1)) < task_count) {
+            try {
+                (*task)(index, worker);
+            } catch (...) {
+                std::lock_guard<std::mutex> error_lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                // Skip whatever hasn't been picked up yet
+                next_index = task_count;
+            }
+        }
+
+        lock.lock();
+        if (--active_workers == 0) {
+            finished.notify_one();
+        }
+    }
+}
+
+ThreadPool& sharedThreadPool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+}
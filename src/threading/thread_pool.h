@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+#include <stdint.h>
+
+namespace cscd {
+
+// Fixed set of worker threads for splitting a loop over many independent
+// items. parallelFor calls are serialised, so the pool can be shared between
+// threads, but a task must not call back into the pool it is running on.
+class ThreadPool {
+public:
+    using Task = std::function<void(uint32_t index, unsigned worker)>;
+
+    // 0 uses one thread per hardware thread
+    ThreadPool(unsigned thread_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned getThreadCount() const { return workers.size(); }
+
+    // Runs task for every index in [0, count) and waits for all of them. worker
+    // is in [0, getThreadCount()), so per worker scratch can be indexed by it.
+    // The first exception a task throws is rethrown once the others are done.
+    void parallelFor(uint32_t count, const Task& task);
+
+private:
+    void workerLoop(unsigned worker);
+
+    std::vector<std::thread> workers;
+    std::mutex call_mutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    const Task* task = nullptr;
+    uint32_t task_count = 0;
+    std::atomic<uint32_t> next_index{0};
+    unsigned active_workers = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+};
+
+// Process wide pool used by the file readers / writers
+ThreadPool& sharedThreadPool();
+
+}